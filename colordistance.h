@@ -0,0 +1,211 @@
+/**
+ * @file colordistance.h
+ * Color distance policies used to parameterize the Quadtree prune family.
+ */
+
+#ifndef COLORDISTANCE_H
+#define COLORDISTANCE_H
+
+#include "rgbapixel.h"
+#include "labcolor.h"
+
+/**
+ * Shared batch evaluation for the distance policies below.
+ *
+ * A distance policy is a class with only static members, so that
+ * Quadtree::prune<Distance>, pruneSize<Distance> and idealPrune<Distance>
+ * are resolved at compile time and the distance computation is inlined
+ * into the traversal. Every policy provides:
+ *
+ *  - Color, the representation in which distances are measured;
+ *  - MAX_DISTANCE, an upper bound on distance() between any two pixels;
+ *  - convert(), which maps an RGBAPixel to a Color;
+ *  - distance(), which measures two Colors;
+ *  - maxDistance(), inherited from this class, which measures a reference
+ *    color against a whole batch of colors.
+ *
+ * @tparam Policy The policy deriving from this class
+ * @tparam ColorType The policy's Color type
+ */
+template <class Policy, class ColorType>
+class BatchDistance
+{
+  public:
+    typedef ColorType Color;
+
+    /**
+     * Returns the largest distance between ref and any of the count
+     * colors. The loop has no early exit and no data-dependent branches,
+     * so the compiler is free to vectorize it.
+     *
+     * @param ref The color every other color is measured against
+     * @param colors Pointer to the first of the colors to measure
+     * @param count How many colors there are
+     * @return The largest distance found, or 0 if count is 0
+     */
+    static int maxDistance(Color const& ref, Color const* colors, int count)
+    {
+        int result = 0;
+        for (int i = 0; i < count; i++) {
+            int d = Policy::distance(ref, colors[i]);
+            result = d > result ? d : result;
+        }
+        return result;
+    }
+};
+
+/**
+ * Squared Euclidean distance over red, green and blue. Alpha is ignored.
+ * This is the metric the untemplated prune functions have always used.
+ */
+class RGBDistance : public BatchDistance<RGBDistance, RGBAPixel>
+{
+  public:
+    static const int MAX_DISTANCE = 3 * (255 * 255);
+
+    static Color convert(RGBAPixel const& pixel) { return pixel; }
+
+    static int distance(Color const& a, Color const& b)
+    {
+        int dr = a.red - b.red;
+        int dg = a.green - b.green;
+        int db = a.blue - b.blue;
+        return dr * dr + dg * dg + db * db;
+    }
+};
+
+/**
+ * Squared Euclidean distance over red, green, blue and alpha, so that
+ * regions which only differ in transparency are kept apart.
+ */
+class RGBADistance : public BatchDistance<RGBADistance, RGBAPixel>
+{
+  public:
+    static const int MAX_DISTANCE = 4 * (255 * 255);
+
+    static Color convert(RGBAPixel const& pixel) { return pixel; }
+
+    static int distance(Color const& a, Color const& b)
+    {
+        int dr = a.red - b.red;
+        int dg = a.green - b.green;
+        int db = a.blue - b.blue;
+        int da = a.alpha - b.alpha;
+        return dr * dr + dg * dg + db * db + da * da;
+    }
+};
+
+/**
+ * Chebyshev distance: the largest absolute difference over red, green,
+ * blue and alpha. Tolerances are therefore in plain channel units (0-255).
+ */
+class ChebyshevDistance : public BatchDistance<ChebyshevDistance, RGBAPixel>
+{
+  public:
+    static const int MAX_DISTANCE = 255;
+
+    static Color convert(RGBAPixel const& pixel) { return pixel; }
+
+    static int distance(Color const& a, Color const& b)
+    {
+        int dr = absolute(a.red - b.red);
+        int dg = absolute(a.green - b.green);
+        int db = absolute(a.blue - b.blue);
+        int da = absolute(a.alpha - b.alpha);
+        int drg = dr > dg ? dr : dg;
+        int dba = db > da ? db : da;
+        return drg > dba ? drg : dba;
+    }
+
+  private:
+    static int absolute(int n) { return n < 0 ? -n : n; }
+};
+
+/**
+ * Squared distance with each of red, green and blue weighted by its
+ * contribution to luma (ITU-R BT.601: 0.299, 0.587, 0.114). The weights
+ * are scaled to sum to 3, so tolerances are on the same scale as
+ * RGBDistance. Alpha is ignored.
+ */
+class LumaDistance : public BatchDistance<LumaDistance, RGBAPixel>
+{
+  public:
+    static const int MAX_DISTANCE = 3 * (255 * 255);
+
+    static Color convert(RGBAPixel const& pixel) { return pixel; }
+
+    static int distance(Color const& a, Color const& b)
+    {
+        int dr = a.red - b.red;
+        int dg = a.green - b.green;
+        int db = a.blue - b.blue;
+        return (299 * dr * dr + 587 * dg * dg + 114 * db * db) * 3 / 1000;
+    }
+};
+
+/**
+ * Squared CIELAB (CIE76) color difference, \f$\Delta E^2\f$, rounded to the
+ * nearest integer. Distances in CIELAB track perceived differences much
+ * more closely than distances in RGB, so one tolerance behaves similarly
+ * in dark gradients and in saturated regions. A tolerance of 4 allows a
+ * \f$\Delta E\f$ of 2, which is about one just noticeable difference.
+ * Alpha is ignored.
+ *
+ * The prune family converts through a LabCache for the duration of each
+ * call (see ColorConverter), so a color is converted about once per call
+ * rather than once per comparison.
+ */
+class LabDistance : public BatchDistance<LabDistance, LabColor>
+{
+  public:
+    // each of L, a and b spans less than 256 units
+    static const int MAX_DISTANCE = 3 * (256 * 256);
+
+    static Color convert(RGBAPixel const& pixel) { return LabColor::fromRGB(pixel); }
+
+    static int distance(Color const& a, Color const& b)
+    {
+        float dL = a.L - b.L;
+        float da = a.a - b.a;
+        float db = a.b - b.b;
+        return (int) (dL * dL + da * da + db * db + 0.5f);
+    }
+};
+
+/**
+ * Converts pixels with a distance policy for the duration of one call of
+ * the Quadtree prune family. A converter is created by the call and passed
+ * down its traversal, so it can hold scratch state without any sharing
+ * between calls or threads. This one converts directly, which suits the
+ * policies whose convert() is free.
+ *
+ * @tparam Distance The distance policy
+ */
+template <class Distance>
+class ColorConverter
+{
+  public:
+    typename Distance::Color convert(RGBAPixel const& pixel)
+    {
+        return Distance::convert(pixel);
+    }
+};
+
+/**
+ * Converts to CIELAB through a LabCache, since LabDistance::convert() is
+ * the only conversion that costs more than a lookup would.
+ */
+template <>
+class ColorConverter<LabDistance>
+{
+  public:
+    LabColor convert(RGBAPixel const& pixel)
+    {
+        return cache.convert(pixel);
+    }
+
+  private:
+    LabCache cache;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file colormap.cpp
+ * Implementation of the ColorLUT and ColorCube classes.
+ */
+
+#include <cmath>
+
+#include "colormap.h"
+
+namespace
+{
+
+// round value to the nearest integer in [0, 255]
+uint8_t clampByte(double value)
+{
+	if (value <= 0)
+		return 0;
+	if (value >= 255)
+		return 255;
+	return (uint8_t) (value + 0.5);
+}
+
+}
+
+ColorLUT::ColorLUT()
+{
+	for (int i = 0; i < 256; i++)
+		red[i] = green[i] = blue[i] = alpha[i] = (uint8_t) i;
+}
+
+ColorLUT ColorLUT::brightness(int delta)
+{
+	ColorLUT lut;
+	for (int i = 0; i < 256; i++)
+		lut.red[i] = lut.green[i] = lut.blue[i] = clampByte(i + delta);
+	return lut;
+}
+
+ColorLUT ColorLUT::contrast(double factor)
+{
+	ColorLUT lut;
+	for (int i = 0; i < 256; i++)
+		lut.red[i] = lut.green[i] = lut.blue[i] = clampByte((i - 127.5) * factor + 127.5);
+	return lut;
+}
+
+ColorLUT ColorLUT::gamma(double g)
+{
+	ColorLUT lut;
+	for (int i = 0; i < 256; i++)
+		lut.red[i] = lut.green[i] = lut.blue[i] = clampByte(255 * std::pow(i / 255.0, 1 / g));
+	return lut;
+}
+
+ColorCube::ColorCube(int size) : n(size < 2 ? 2 : size), entries(n * n * n)
+{
+	for (int b = 0; b < n; b++)
+		for (int g = 0; g < n; g++)
+			for (int r = 0; r < n; r++)
+				at(r, g, b) = RGBAPixel(clampByte(r * 255.0 / (n - 1)),
+										clampByte(g * 255.0 / (n - 1)),
+										clampByte(b * 255.0 / (n - 1)));
+}
+
+int ColorCube::size() const
+{
+	return n;
+}
+
+RGBAPixel& ColorCube::at(int r, int g, int b)
+{
+	return entries[(b * n + g) * n + r];
+}
+
+RGBAPixel const& ColorCube::at(int r, int g, int b) const
+{
+	return entries[(b * n + g) * n + r];
+}
+
+RGBAPixel ColorCube::operator()(RGBAPixel const& pixel) const
+{
+	// position of pixel in the lattice, split into the cell's lower corner
+	// and the fraction of the way across it
+	uint8_t const channels[3] = { pixel.red, pixel.green, pixel.blue };
+	int low[3];
+	float frac[3];
+	for (int c = 0; c < 3; c++) {
+		float t = channels[c] * (n - 1) / 255.0f;
+		low[c] = (int) t;
+		if (low[c] >= n - 1)
+			low[c] = n - 2;
+		frac[c] = t - low[c];
+	}
+
+	float result[3] = { 0, 0, 0 };
+	for (int corner = 0; corner < 8; corner++) {
+		int dr = corner & 1, dg = (corner >> 1) & 1, db = (corner >> 2) & 1;
+		float weight = (dr ? frac[0] : 1 - frac[0]) *
+					   (dg ? frac[1] : 1 - frac[1]) *
+					   (db ? frac[2] : 1 - frac[2]);
+		RGBAPixel const& entry = at(low[0] + dr, low[1] + dg, low[2] + db);
+		result[0] += weight * entry.red;
+		result[1] += weight * entry.green;
+		result[2] += weight * entry.blue;
+	}
+	return RGBAPixel(clampByte(result[0]), clampByte(result[1]), clampByte(result[2]),
+					 pixel.alpha);
+}
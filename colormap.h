@@ -0,0 +1,120 @@
+/**
+ * @file colormap.h
+ * Color maps for Quadtree::mapColors: per-channel lookup tables and 3D
+ * color cubes.
+ */
+
+#ifndef COLORMAP_H
+#define COLORMAP_H
+
+#include <vector>
+
+#include "rgbapixel.h"
+
+/**
+ * A color map that looks each channel up in its own 256-entry table.
+ * Brightness, contrast, gamma and curves adjustments are all of this
+ * form, and composing two of them is a table lookup per entry.
+ */
+class ColorLUT
+{
+  public:
+    uint8_t red[256];   /**< new value of each red value */
+    uint8_t green[256]; /**< new value of each green value */
+    uint8_t blue[256];  /**< new value of each blue value */
+    uint8_t alpha[256]; /**< new value of each alpha value */
+
+    /**
+     * Constructs the identity map.
+     */
+    ColorLUT();
+
+    /**
+     * Returns the map that adds delta to red, green and blue, clamping
+     * the results to [0, 255]. Alpha is unchanged.
+     * @param delta The amount to add, which may be negative.
+     * @return The brightness map.
+     */
+    static ColorLUT brightness(int delta);
+
+    /**
+     * Returns the map that scales the distance of red, green and blue from
+     * the middle value 127.5 by factor, clamping the results to [0, 255].
+     * Alpha is unchanged.
+     * @param factor Above 1 to increase contrast, below 1 to decrease it.
+     * @return The contrast map.
+     */
+    static ColorLUT contrast(double factor);
+
+    /**
+     * Returns the map that raises red, green and blue, as fractions of
+     * 255, to the power 1 / g. Alpha is unchanged.
+     * @param g The gamma; above 1 brightens the midtones.
+     * @return The gamma map.
+     */
+    static ColorLUT gamma(double g);
+
+    /**
+     * Maps a pixel.
+     * @param pixel The pixel to map.
+     * @return The pixel with each channel looked up in its table.
+     */
+    RGBAPixel operator()(RGBAPixel const& pixel) const
+    {
+        return RGBAPixel(red[pixel.red], green[pixel.green], blue[pixel.blue],
+                         alpha[pixel.alpha]);
+    }
+};
+
+/**
+ * A 3D lookup table, as used for color grading: red, green and blue are
+ * mapped together by trilinear interpolation between the entries of a
+ * size by size by size lattice spanning the RGB cube. Alpha is unchanged.
+ */
+class ColorCube
+{
+  public:
+    /**
+     * Constructs the identity cube with the given number of entries along
+     * each axis.
+     * @param size Entries along each axis, at least 2 (33 is common).
+     */
+    explicit ColorCube(int size);
+
+    /**
+     * @return The number of entries along each axis.
+     */
+    int size() const;
+
+    /**
+     * Gets the entry at the given lattice point, which holds the color
+     * that (r, g, b) * 255 / (size - 1) maps to. Its alpha is ignored.
+     * @param r Index along the red axis, less than size().
+     * @param g Index along the green axis, less than size().
+     * @param b Index along the blue axis, less than size().
+     * @return A reference to the entry, through which it may be changed.
+     */
+    RGBAPixel& at(int r, int g, int b);
+
+    /**
+     * Const version of the previous at().
+     * @param r Index along the red axis, less than size().
+     * @param g Index along the green axis, less than size().
+     * @param b Index along the blue axis, less than size().
+     * @return A reference to the entry.
+     */
+    RGBAPixel const& at(int r, int g, int b) const;
+
+    /**
+     * Maps a pixel by interpolating between the eight entries around it.
+     * @param pixel The pixel to map.
+     * @return The mapped pixel, with pixel's alpha.
+     */
+    RGBAPixel operator()(RGBAPixel const& pixel) const;
+
+  private:
+    int n;                          /**< entries along each axis */
+    std::vector<RGBAPixel> entries; /**< red fastest, then green, then blue */
+};
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file labcolor.cpp
+ * Implementation of the LabColor class.
+ */
+
+#include <cmath>
+
+#include "labcolor.h"
+
+namespace
+{
+
+// number of intervals the CIELAB f() table divides [0, 1] into
+const int F_TABLE_SIZE = 1024;
+
+/**
+ * The lookup tables behind LabColor::fromRGB. They are built once, the
+ * first time a conversion is requested.
+ */
+class LabTables
+{
+  public:
+	float linear[256];              // sRGB byte -> linear intensity
+	float f[F_TABLE_SIZE + 2];      // CIELAB f(t) sampled over [0, 1]
+
+	LabTables()
+	{
+		for (int i = 0; i < 256; i++) {
+			double c = i / 255.0;
+			linear[i] = (float) (c <= 0.04045 ? c / 12.92
+											  : std::pow((c + 0.055) / 1.055, 2.4));
+		}
+		// one extra sample so that interpolating at t = 1 stays in bounds
+		for (int i = 0; i <= F_TABLE_SIZE + 1; i++)
+			f[i] = (float) exact((double) i / F_TABLE_SIZE);
+	}
+
+	// f(t), linearly interpolated from the table; t is clamped to [0, 1]
+	float lookup(float t) const
+	{
+		if (t <= 0.0f)
+			return f[0];
+		if (t >= 1.0f)
+			return f[F_TABLE_SIZE];
+		float pos = t * F_TABLE_SIZE;
+		int i = (int) pos;
+		float frac = pos - i;
+		return f[i] + (f[i + 1] - f[i]) * frac;
+	}
+
+  private:
+	static double exact(double t)
+	{
+		const double epsilon = 216.0 / 24389.0;
+		const double kappa = 24389.0 / 27.0;
+		return t > epsilon ? std::cbrt(t) : (kappa * t + 16.0) / 116.0;
+	}
+};
+
+LabTables const& tables()
+{
+	static LabTables instance;
+	return instance;
+}
+
+}
+
+LabColor::LabColor() : L(0), a(0), b(0)
+{
+	/* nothing */
+}
+
+LabColor::LabColor(float l, float aa, float bb) : L(l), a(aa), b(bb)
+{
+	/* nothing */
+}
+
+LabColor LabColor::fromRGB(RGBAPixel const& pixel)
+{
+	LabTables const& t = tables();
+	float r = t.linear[pixel.red];
+	float g = t.linear[pixel.green];
+	float b = t.linear[pixel.blue];
+
+	// linear sRGB -> XYZ, already divided by the D65 white point
+	float x = (0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / 0.95047f;
+	float y = 0.2126729f * r + 0.7151522f * g + 0.0721750f * b;
+	float z = (0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / 1.08883f;
+
+	float fx = t.lookup(x);
+	float fy = t.lookup(y);
+	float fz = t.lookup(z);
+	return LabColor(116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz));
+}
+
+LabCache::LabCache() : keys(1 << BITS, 0xffffffffu), values(1 << BITS)
+{
+	/* nothing */
+}
@@ -0,0 +1,92 @@
+/**
+ * @file labcolor.h
+ * Definition of the LabColor class and the sRGB to CIELAB conversion.
+ */
+
+#ifndef LABCOLOR_H
+#define LABCOLOR_H
+
+#include <cstdint>
+#include <vector>
+
+#include "rgbapixel.h"
+
+/**
+ * Represents a color in the CIELAB color space (D65 white point).
+ */
+class LabColor
+{
+  public:
+    float L; /**< lightness, from 0 (black) to 100 (white) */
+    float a; /**< green (negative) to red (positive) axis */
+    float b; /**< blue (negative) to yellow (positive) axis */
+
+    /**
+     * Constructs black, i.e. (0, 0, 0).
+     */
+    LabColor();
+
+    /**
+     * Constructs the CIELAB color with the given components.
+     * @param L Lightness component.
+     * @param a Green-red component.
+     * @param b Blue-yellow component.
+     */
+    LabColor(float L, float a, float b);
+
+    /**
+     * Converts the red, green and blue components of an sRGB pixel to
+     * CIELAB. Alpha is ignored.
+     *
+     * The conversion uses precomputed tables for both non-linear steps
+     * (sRGB gamma decoding and the CIELAB cube root), so it costs a
+     * handful of table lookups and multiplications.
+     *
+     * @param pixel The pixel to convert.
+     * @return The CIELAB color of pixel.
+     */
+    static LabColor fromRGB(RGBAPixel const& pixel);
+};
+
+/**
+ * A fixed-size, direct-mapped memo of LabColor::fromRGB, keyed on red,
+ * green and blue. Images repeat colors heavily, so most conversions are
+ * answered by one lookup; a miss converts and replaces the entry.
+ *
+ * A LabCache is scratch space for one caller and is not safe to share
+ * between threads.
+ */
+class LabCache
+{
+  public:
+    /**
+     * Constructs an empty cache.
+     */
+    LabCache();
+
+    /**
+     * Returns LabColor::fromRGB(pixel), from the cache if possible.
+     * @param pixel The pixel to convert.
+     * @return The CIELAB color of pixel.
+     */
+    LabColor convert(RGBAPixel const& pixel)
+    {
+        std::uint32_t key = (std::uint32_t) pixel.red << 16 |
+                            (std::uint32_t) pixel.green << 8 | pixel.blue;
+        std::uint32_t slot = (key * 2654435761u) >> (32 - BITS);
+        if (keys[slot] != key) {
+            keys[slot] = key;
+            values[slot] = LabColor::fromRGB(pixel);
+        }
+        return values[slot];
+    }
+
+  private:
+    static const int BITS = 12; // the cache has 2^BITS entries
+
+    std::vector<std::uint32_t> keys; // key of each entry, or a value above
+                                     // 24 bits if the entry is unused
+    std::vector<LabColor> values;    // the conversion of each key
+};
+
+#endif
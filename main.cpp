@@ -3,6 +3,7 @@
  * Contains code to test your Quadtree implementation.
  */
 
+#include <algorithm>
 #include <iostream>
 #include "png.h"
 #include "quadtree.h"
@@ -10,6 +11,54 @@
 using std::cout;
 using std::endl;
 
+// count the pixels at which tree.getPixel disagrees with img
+int getPixelMismatches(Quadtree const& tree, PNG const& img)
+{
+    int mismatches = 0;
+    for (size_t y = 0; y < img.height(); y++)
+        for (size_t x = 0; x < img.width(); x++)
+            if (tree.getPixel(x, y) != *img(x, y))
+                mismatches++;
+    return mismatches;
+}
+
+// return img mirrored left to right
+PNG mirrorX(PNG const& img)
+{
+    PNG result(img.width(), img.height());
+    for (size_t y = 0; y < img.height(); y++)
+        for (size_t x = 0; x < img.width(); x++)
+            *result(img.width() - 1 - x, y) = *img(x, y);
+    return result;
+}
+
+// return img box filtered by brute force, repeating its edge pixels
+PNG naiveBoxBlur(PNG const& img, int radius)
+{
+    int n = img.width();
+    int area = (2 * radius + 1) * (2 * radius + 1);
+    PNG result(n, n);
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            int sum[4] = {0, 0, 0, 0};
+            for (int dy = -radius; dy <= radius; dy++) {
+                for (int dx = -radius; dx <= radius; dx++) {
+                    int sx = std::min(std::max(x + dx, 0), n - 1);
+                    int sy = std::min(std::max(y + dy, 0), n - 1);
+                    RGBAPixel const* p = img(sx, sy);
+                    sum[0] += p->red;
+                    sum[1] += p->green;
+                    sum[2] += p->blue;
+                    sum[3] += p->alpha;
+                }
+            }
+            *result(x, y) = RGBAPixel((sum[0] + area / 2) / area, (sum[1] + area / 2) / area,
+                                      (sum[2] + area / 2) / area, (sum[3] + area / 2) / area);
+        }
+    }
+    return result;
+}
+
 int main()
 {
 
@@ -64,6 +113,68 @@ int main()
     imgOut = fullTree3.decompress();
     imgOut.writeToFile("outEtc.png");
 
+    // test the orientation functions against the same operations on the PNG
+    PNG square = fullTree2.decompress();
+    PNG expected = square;
+    Quadtree orientTree(fullTree2);
+    orientTree.clockwiseRotate();
+    expected.rotate90();
+    cout << "clockwiseRotate matches PNG::rotate90 = "
+         << (orientTree.decompress() == expected) << endl;
+    cout << "getPixel mismatches after clockwiseRotate = "
+         << getPixelMismatches(orientTree, expected) << endl;
+    orientTree.flipHorizontal();
+    expected = mirrorX(expected);
+    cout << "flipHorizontal matches mirrored PNG = "
+         << (orientTree.decompress() == expected) << endl;
+    orientTree.transpose();
+    expected.transpose();
+    cout << "transpose matches PNG::transpose = "
+         << (orientTree.decompress() == expected) << endl;
+    orientTree.rotate180();
+    expected.rotate180();
+    cout << "getPixel mismatches after rotate180 = "
+         << getPixelMismatches(orientTree, expected) << endl;
+    orientTree.materialize();
+    cout << "materialize keeps the image = "
+         << (orientTree.decompress() == expected) << endl;
+    cout << "materialized tree == tree of the transformed PNG = "
+         << (orientTree == Quadtree(expected, 256)) << endl;
+
+    // test reversiblePrune and unprune against prune
+    Quadtree stashTree(fullTree2);
+    stashTree.reversiblePrune(1000);
+    cout << "reversiblePrune(1000) matches prune(1000) = "
+         << (stashTree.decompress() == fullTree.decompress()) << endl;
+    stashTree.unprune(-1);
+    cout << "unprune(-1) restores the image = "
+         << (stashTree.decompress() == square) << endl;
+    stashTree.unprune(1000);
+    cout << "unprune(1000) matches prune(1000) = "
+         << (stashTree.decompress() == fullTree.decompress()) << endl;
+
+    // test composite: an opaque left half over a transparent right half
+    PNG overlay(256, 256);
+    for (int y = 0; y < 256; y++)
+        for (int x = 0; x < 256; x++)
+            *overlay(x, y) = x < 128 ? RGBAPixel(255, 0, 0, 255) : RGBAPixel(0, 0, 255, 0);
+    Quadtree compositeTree(fullTree2);
+    compositeTree.composite(Quadtree(overlay, 256), Quadtree::OVER);
+    expected = square;
+    for (int y = 0; y < 256; y++)
+        for (int x = 0; x < 128; x++)
+            *expected(x, y) = *overlay(x, y);
+    cout << "composite OVER matches the PNG = "
+         << (compositeTree.decompress() == expected) << endl;
+
+    // test boxBlur and gaussianBlur
+    cout << "boxBlur(0) matches decompress = "
+         << (fullTree.boxBlur(0) == fullTree.decompress()) << endl;
+    cout << "boxBlur(3) matches a brute-force blur = "
+         << (fullTree.boxBlur(3) == naiveBoxBlur(fullTree.decompress(), 3)) << endl;
+    cout << "gaussianBlur(0) matches decompress = "
+         << (fullTree.gaussianBlur(0) == fullTree.decompress()) << endl;
+
     // ensure that printTree still works
     Quadtree tinyTree(imgIn, 32);
     cout << "Printing tinyTree:\n";
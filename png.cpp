@@ -8,8 +8,13 @@
  * @date Modified: Summer 2012
  */
 
+#include <algorithm>
 #include <cstdint>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "png.h"
 
 using std::uint8_t;
@@ -19,6 +24,84 @@ inline void epng_err(string const & err)
 	cerr << "[EasyPNG]: " << err << endl;
 }
 
+// width and height, in pixels, of the tiles transpose works through; two
+// 64 x 64 tiles of 4 byte pixels fit in a 32 KB L1 cache
+static const size_t TRANSPOSE_TILE = 64;
+
+// load the 4 x 4 block of pixels at a and the one at b, each with rows
+// stride pixels apart, and store each one's transpose where the other was;
+// a and b may be the same block, which transposes it in place
+static inline void transpose_swap_4x4(RGBAPixel * a, RGBAPixel * b, size_t stride)
+{
+#ifdef __SSE2__
+	// a pixel is 32 bits, so a row of four is one 128 bit register
+	__m128i ra[4], rb[4];
+	for (int i = 0; i < 4; i++)
+	{
+		ra[i] = _mm_loadu_si128((__m128i const *) (a + i * stride));
+		rb[i] = _mm_loadu_si128((__m128i const *) (b + i * stride));
+	}
+	__m128i * blocks[2] = { ra, rb };
+	for (int k = 0; k < 2; k++)
+	{
+		__m128i * r = blocks[k];
+		__m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+		__m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+		__m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+		__m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+		r[0] = _mm_unpacklo_epi64(t0, t1);
+		r[1] = _mm_unpackhi_epi64(t0, t1);
+		r[2] = _mm_unpacklo_epi64(t2, t3);
+		r[3] = _mm_unpackhi_epi64(t2, t3);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storeu_si128((__m128i *) (b + i * stride), ra[i]);
+		_mm_storeu_si128((__m128i *) (a + i * stride), rb[i]);
+	}
+#else
+	RGBAPixel ta[16], tb[16];
+	for (size_t i = 0; i < 4; i++)
+	{
+		for (size_t j = 0; j < 4; j++)
+		{
+			ta[j * 4 + i] = a[i * stride + j];
+			tb[j * 4 + i] = b[i * stride + j];
+		}
+	}
+	for (size_t i = 0; i < 4; i++)
+	{
+		std::copy(ta + i * 4, ta + i * 4 + 4, b + i * stride);
+		std::copy(tb + i * 4, tb + i * 4 + 4, a + i * stride);
+	}
+#endif
+}
+
+// store the transpose of the 4 x 4 block of pixels at src, whose rows are
+// src_stride pixels apart, at dst, whose rows are dst_stride pixels apart
+static inline void transpose_copy_4x4(RGBAPixel const * src, size_t src_stride,
+		RGBAPixel * dst, size_t dst_stride)
+{
+#ifdef __SSE2__
+	__m128i r0 = _mm_loadu_si128((__m128i const *) src);
+	__m128i r1 = _mm_loadu_si128((__m128i const *) (src + src_stride));
+	__m128i r2 = _mm_loadu_si128((__m128i const *) (src + 2 * src_stride));
+	__m128i r3 = _mm_loadu_si128((__m128i const *) (src + 3 * src_stride));
+	__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+	__m128i t1 = _mm_unpacklo_epi32(r2, r3);
+	__m128i t2 = _mm_unpackhi_epi32(r0, r1);
+	__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+	_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi64(t0, t1));
+	_mm_storeu_si128((__m128i *) (dst + dst_stride), _mm_unpackhi_epi64(t0, t1));
+	_mm_storeu_si128((__m128i *) (dst + 2 * dst_stride), _mm_unpacklo_epi64(t2, t3));
+	_mm_storeu_si128((__m128i *) (dst + 3 * dst_stride), _mm_unpackhi_epi64(t2, t3));
+#else
+	for (size_t i = 0; i < 4; i++)
+		for (size_t j = 0; j < 4; j++)
+			dst[j * dst_stride + i] = src[i * src_stride + j];
+#endif
+}
+
 RGBAPixel & PNG::_pixel(size_t x, size_t y) const
 {
 	return _pixels[_width * y + x];
@@ -190,6 +273,16 @@ RGBAPixel const * PNG::operator()(size_t x, size_t y) const
 	return &(_pixel(x,y));
 }
 
+RGBAPixel * PNG::row(size_t y)
+{
+	return &(_pixel(0,y));
+}
+
+RGBAPixel const * PNG::row(size_t y) const
+{
+	return &(_pixel(0,y));
+}
+
 bool PNG::readFromFile(string const & file_name)
 {
 	_clear();
@@ -341,6 +434,13 @@ bool PNG::_read_file(string const & file_name)
 }
 
 bool PNG::writeToFile(string const & file_name)
+{
+	return writeToFile(file_name, _width, _height,
+		[this](size_t y, RGBAPixel *) -> RGBAPixel const * { return row(y); });
+}
+
+bool PNG::writeToFile(string const & file_name, size_t width_arg,
+		size_t height_arg, RowSource const & rows)
 {
 	FILE * fp = fopen(file_name.c_str(), "wb");
 	if (!fp)
@@ -384,7 +484,7 @@ bool PNG::writeToFile(string const & file_name)
 		fclose(fp);
 		return false;
 	}
-	png_set_IHDR(png_ptr, info_ptr, _width, _height, 
+	png_set_IHDR(png_ptr, info_ptr, width_arg, height_arg, 
 			8,
 			PNG_COLOR_TYPE_RGB_ALPHA, 
 			PNG_INTERLACE_NONE, 
@@ -402,21 +502,16 @@ bool PNG::writeToFile(string const & file_name)
 		return false;
 	}
 
-	int bpr = png_get_rowbytes(png_ptr, info_ptr);
-	png_byte * row = new png_byte[bpr];
-	for (size_t y = 0; y < _height; y++)
+	// RGBAPixel stores red, green, blue and alpha bytes in that order, which
+	// is exactly libpng's layout for an 8 bit RGBA row
+	static_assert(sizeof(RGBAPixel) == 4, "RGBAPixel must be 4 packed bytes");
+	RGBAPixel * buffer = new RGBAPixel[width_arg];
+	for (size_t y = 0; y < height_arg; y++)
 	{
-		for (size_t x = 0; x < _width; x++)
-		{
-			png_byte * pix = &(row[x*4]);
-			pix[0] = _pixel(x,y).red;
-			pix[1] = _pixel(x,y).green;
-			pix[2] = _pixel(x,y).blue;
-			pix[3] = _pixel(x,y).alpha;
-		}
-		png_write_row(png_ptr, row);
+		RGBAPixel const * pixels = rows(y, buffer);
+		png_write_row(png_ptr, (png_bytep) pixels);
 	}
-	delete [] row;
+	delete [] buffer;
 	png_write_end(png_ptr, NULL);
 	png_destroy_write_struct(&png_ptr, &info_ptr);
 	fclose(fp);
@@ -465,3 +560,76 @@ void PNG::resize(size_t width_arg, size_t height_arg)
 	_width = width_arg;
 	_height = height_arg;
 }
+
+void PNG::transpose()
+{
+	if (_width == _height)
+	{
+		// swap each tile above the diagonal with its mirror image below it,
+		// four by four; tiles on the diagonal are swapped with themselves
+		size_t n = _width;
+		size_t blocked = n & ~(size_t) 3;
+		for (size_t ty = 0; ty < blocked; ty += TRANSPOSE_TILE)
+		{
+			for (size_t tx = ty; tx < blocked; tx += TRANSPOSE_TILE)
+			{
+				size_t y_end = std::min(ty + TRANSPOSE_TILE, blocked);
+				size_t x_end = std::min(tx + TRANSPOSE_TILE, blocked);
+				for (size_t y = ty; y < y_end; y += 4)
+				{
+					for (size_t x = (tx == ty ? y : tx); x < x_end; x += 4)
+						transpose_swap_4x4(&_pixel(x, y), &_pixel(y, x), n);
+				}
+			}
+		}
+		// the last n % 4 columns, and the rows mirroring them
+		for (size_t y = 0; y < n; y++)
+		{
+			for (size_t x = std::max(y + 1, blocked); x < n; x++)
+				std::swap(_pixel(x, y), _pixel(y, x));
+		}
+		return;
+	}
+
+	RGBAPixel * arr = new RGBAPixel[_width * _height];
+	for (size_t ty = 0; ty < _height; ty += TRANSPOSE_TILE)
+	{
+		for (size_t tx = 0; tx < _width; tx += TRANSPOSE_TILE)
+		{
+			size_t y_end = std::min(ty + TRANSPOSE_TILE, _height);
+			size_t x_end = std::min(tx + TRANSPOSE_TILE, _width);
+			for (size_t y = ty; y < y_end; y += 4)
+			{
+				for (size_t x = tx; x < x_end; x += 4)
+				{
+					if (y + 4 <= y_end && x + 4 <= x_end)
+					{
+						transpose_copy_4x4(&_pixel(x, y), _width,
+								arr + x * _height + y, _height);
+						continue;
+					}
+					// a partial block at the bottom or right edge
+					for (size_t i = y; i < std::min(y + 4, y_end); i++)
+						for (size_t j = x; j < std::min(x + 4, x_end); j++)
+							arr[j * _height + i] = _pixel(j, i);
+				}
+			}
+		}
+	}
+	delete [] _pixels;
+	_pixels = arr;
+	std::swap(_width, _height);
+}
+
+void PNG::rotate90()
+{
+	transpose();
+	for (size_t y = 0; y < _height; y++)
+		std::reverse(row(y), row(y) + _width);
+}
+
+void PNG::rotate180()
+{
+	// reading the pixels backwards reverses both the rows and the columns
+	std::reverse(_pixels, _pixels + _width * _height);
+}
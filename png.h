@@ -17,6 +17,7 @@
 #include <png.h>
 
 // c++ style includes
+#include <functional>
 #include <string>
 #include <iostream>
 #include <sstream>
@@ -109,6 +110,26 @@ class PNG
          */
         RGBAPixel const * operator()(size_t x, size_t y) const;
 
+        /**
+         * Non-const row access. Gets a pointer to the first pixel of the
+         * given row. The pixels of a row are stored contiguously from left
+         * to right, and rows are stored one after another from top to
+         * bottom, so whole rows can be read or written through this
+         * pointer. Unlike operator(), y is not clamped.
+         * @param y Y-coordinate of the row, which must be less than height().
+         * @return A pointer to the pixel at (0, y).
+         */
+        RGBAPixel * row(size_t y);
+
+        /**
+         * Const row access. Const version of the previous row(). Does not
+         * allow the image to be changed via the pointer.
+         * @param y Y-coordinate of the row, which must be less than height().
+         * @return A pointer to the pixel at (0, y) (can't change the pixels
+         *	through this pointer).
+         */
+        RGBAPixel const * row(size_t y) const;
+
         /**
          * Reads in a PNG image from a file.
          * Overwrites any current image content in the PNG. In the event of
@@ -125,6 +146,30 @@ class PNG
          */
         bool writeToFile(string const & file_name);
 
+        /**
+         * Gets one row of an image that is being streamed to a file; see
+         * the static writeToFile. Called with the row's y-coordinate and a
+         * scratch buffer of width pixels. The same buffer is passed for
+         * every row and keeps its contents between calls, so a row that is
+         * identical to the previous one need not be filled again.
+         * Returns a pointer to the width pixels to write, which may be the
+         * buffer itself.
+         */
+        typedef std::function<RGBAPixel const * (size_t y, RGBAPixel * buffer)> RowSource;
+
+        /**
+         * Writes an image to a file one row at a time, without the whole
+         * image ever being in memory. Rows are requested from top to
+         * bottom.
+         * @param file_name Name of the file to write to.
+         * @param width Width of the image.
+         * @param height Height of the image.
+         * @param rows Produces each row of the image.
+         * @return Whether the file was written successfully or not.
+         */
+        static bool writeToFile(string const & file_name, size_t width,
+                                size_t height, RowSource const & rows);
+
         /**
          * Gets the width of this image.
          * @return Width of the image.
@@ -146,6 +191,28 @@ class PNG
          */
         void resize(size_t width, size_t height);
 
+        /**
+         * Transposes the image: the pixel at (x, y) moves to (y, x), and
+         * the width and height are swapped. The image is processed in
+         * tiles that fit in cache, four by four pixels at a time (with
+         * SSE2 where available). A square image is transposed in place.
+         */
+        void transpose();
+
+        /**
+         * Rotates the image 90 degrees clockwise: the pixel at (x, y)
+         * moves to (height - 1 - y, x), and the width and height are
+         * swapped. This is a transpose followed by reversing each row, so
+         * a square image is rotated in place.
+         */
+        void rotate90();
+
+        /**
+         * Rotates the image 180 degrees in place: the pixel at (x, y)
+         * moves to (width - 1 - x, height - 1 - y).
+         */
+        void rotate180();
+
     private:
         // storage
         size_t _width;
@@ -3,22 +3,40 @@
  * Quadtree class implementation.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstddef>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <queue>
+#include <system_error>
+#include <thread>
+#include <typeinfo>
+#include <utility>
 
 using namespace std;
 
 #include "quadtree.h"
 #include "png.h"
 
-const int MIN_TOLERANCE = 0;
-const int MAX_TOLERANCE = 3 * (255 * 255);  // the "difference" between white and black color according to prune()
+const int Quadtree::ORIENTATIONS[8][4] = {
+	{ 0, 1, 2, 3 },		// IDENTITY
+	{ 1, 0, 3, 2 },		// MIRROR_X
+	{ 2, 3, 0, 1 },		// MIRROR_Y
+	{ 3, 2, 1, 0 },		// ROTATE_180
+	{ 0, 2, 1, 3 },		// TRANSPOSE
+	{ 1, 3, 0, 2 },		// ROTATE_CCW
+	{ 2, 0, 3, 1 },		// ROTATE_CW
+	{ 3, 1, 2, 0 }		// ANTI_TRANSPOSE
+};
 
 // Quadtree
 //   - parameters: none
 //   - constructor for the Quadtree class; makes an empty tree
-Quadtree::Quadtree() : root(NULL), res(0) {}
+Quadtree::Quadtree() : root(NULL), res(0), orientation(IDENTITY), stashed(0), stashPolicy(NULL) {}
 
 // Quadtree
 //   - parameters: PNG const & source - reference to a const PNG
@@ -31,6 +49,9 @@ Quadtree::Quadtree() : root(NULL), res(0) {}
 Quadtree::Quadtree(PNG const& source, int resolution)
 {
 	root = NULL;
+	orientation = IDENTITY;
+	stashed = 0;
+	stashPolicy = NULL;
 	buildTree(source, resolution);
 }
 
@@ -41,15 +62,30 @@ Quadtree::Quadtree(PNG const& source, int resolution)
 Quadtree::Quadtree(Quadtree const& other) 
 {
 	root = NULL;
+	orientation = IDENTITY;
+	stashed = 0;
+	stashPolicy = NULL;
 	copyQuadtree(other);
 }
 
+// Quadtree
+//   - parameters: Quadtree && other - the Quadtree to move from
+//   - move constructor for the Quadtree class
+Quadtree::Quadtree(Quadtree&& other)
+{
+	root = NULL;
+	orientation = IDENTITY;
+	stashed = 0;
+	stashPolicy = NULL;
+	moveQuadtree(other);
+}
+
 // ~Quadtree
 //   - parameters: none
 //   - destructor for the Quadtree class
 Quadtree::~Quadtree()
 {
-	deleteQuadtree(root);
+	deleteQuadtree();
 }
 
 // operator=
@@ -63,10 +99,21 @@ Quadtree const& Quadtree::operator=(Quadtree const& other)
 	return *this;
 }
 
+// operator=
+//   - parameters: Quadtree && other - the Quadtree to move from
+//   - return value: a const reference to the current Quadtree
+//   - move assignment operator for the Quadtree class
+Quadtree const& Quadtree::operator=(Quadtree&& other)
+{
+	if (this != &other) moveQuadtree(other);
+	return *this;
+}
+
 // helper function for deep delete
 // Used by destructor and copy/assignment
 // Deallocates Quadtree and its QuadtreeNode
 void Quadtree::deleteQuadtree(){
+	commitStash();
 	if (root != NULL) deleteQuadtree(root);
 }
 
@@ -77,23 +124,46 @@ void Quadtree::deleteQuadtree(QuadtreeNode*& node){
 		deleteQuadtree(node->neChild);
 		deleteQuadtree(node->swChild);
 		deleteQuadtree(node->seChild);
-		delete node;
+		deleteNode(node);
 		node = NULL;
 	}
 }
 
+// delete node, but not its children, as the class it was allocated as;
+// QuadtreeNode has no virtual destructor, so hasStats tells them apart
+void Quadtree::deleteNode(QuadtreeNode* node){
+	if (node->hasStats){
+		delete static_cast<StatsNode*>(node);
+	} else {
+		delete node;
+	}
+}
+
 // helper function for deep copy
 // Used by copy constructor and operator=
 void Quadtree::copyQuadtree(Quadtree const& other){
 	deleteQuadtree();
 	res = other.res;
+	orientation = other.orientation;
 	copyQuadtree(root, other.root);
 }
 
 // helper function for copyQuadtree(Quadtree const& other)
 void Quadtree::copyQuadtree(QuadtreeNode*& myNode, QuadtreeNode* const& otherNode){
 	if (otherNode != NULL){
-		myNode = new QuadtreeNode(otherNode->element);
+		if (otherNode->hasStats){
+			StatsNode const* otherStats = static_cast<StatsNode const*>(otherNode);
+			StatsNode* stats = new StatsNode(otherNode->element);
+			for (int c = 0; c < 4; c++){
+				stats->sum[c] = otherStats->sum[c];
+				stats->sumSq[c] = otherStats->sumSq[c];
+			}
+			stats->hash = otherStats->hash;
+			myNode = stats;
+		} else {
+			myNode = new QuadtreeNode(otherNode->element);
+		}
+		myNode->hashStale = otherNode->hashStale;
 		copyQuadtree(myNode->nwChild, otherNode->nwChild);
 		copyQuadtree(myNode->neChild, otherNode->neChild);
 		copyQuadtree(myNode->swChild, otherNode->swChild);
@@ -101,6 +171,23 @@ void Quadtree::copyQuadtree(QuadtreeNode*& myNode, QuadtreeNode* const& otherNod
 	}
 }
 
+// helper function for move
+// Used by move constructor and move assignment
+// Takes over other's contents and leaves other empty
+void Quadtree::moveQuadtree(Quadtree& other){
+	deleteQuadtree();
+	root = other.root;
+	res = other.res;
+	orientation = other.orientation;
+	stash.swap(other.stash);
+	stashed = other.stashed;
+	stashPolicy = other.stashPolicy;
+	other.root = NULL;
+	other.res = 0;
+	other.orientation = IDENTITY;
+	other.stashed = 0;
+	other.stashPolicy = NULL;
+}
 
 // buildTree (public interface)
 //   - parameters: PNG const & source - reference to a const PNG
@@ -114,6 +201,7 @@ void Quadtree::buildTree(PNG const& source, int resolution)
 {
 	deleteQuadtree();
 	res = resolution;
+	orientation = IDENTITY;
 	buildTree(source, resolution, 0, 0, root);
 }
 
@@ -129,16 +217,20 @@ void Quadtree::buildTree(PNG const& source, int resolution)
 void Quadtree::buildTree(PNG const& source, int resolution, int x, int y, QuadtreeNode*& node){
 	if (resolution == 1) {
 		const RGBAPixel* pixel = source(x, y);
+		// a single pixel's statistics are those of its color
 		node = new QuadtreeNode(*pixel);
 	} else {
-		node = new QuadtreeNode();
+		node = new StatsNode();
 		int childResolution = resolution / 2;
 		buildTree(source, childResolution, x, y, node->nwChild);
 		buildTree(source, childResolution, x+childResolution, y, node->neChild);
 		buildTree(source, childResolution, x, y+childResolution, node->swChild);
 		buildTree(source, childResolution, x+childResolution, y+childResolution, node->seChild);
 		getAvgPixelOfChildren(node);
+		getStatsOfChildren(node);
 	}
+	// the children's hashes are already up to date, so only node is hashed
+	refreshHashes(node);
 }
 
 /* return the average of RGBAPixel of node's children
@@ -161,6 +253,59 @@ uint8_t Quadtree::getAvg(uint8_t n1, uint8_t n2, uint8_t n3, uint8_t n4){
 	return (n1 + n2 + n3 + n4) / 4;
 }
 
+// set the source statistics of node to those of area pixels of node's color
+// A node without stored statistics is a single pixel, whose statistics are
+// always those of its color.
+void Quadtree::setLeafStats(QuadtreeNode* node, int64_t area){
+	if (!node->hasStats) return;
+	StatsNode* stats = static_cast<StatsNode*>(node);
+	uint8_t channels[4] = { node->element.red, node->element.green,
+							node->element.blue, node->element.alpha };
+	for (int c = 0; c < 4; c++){
+		stats->sum[c] = area * channels[c];
+		stats->sumSq[c] = area * channels[c] * channels[c];
+	}
+}
+
+// set the source statistics of node to the sum of its children's
+// Pre-condition: node must be a StatsNode with children
+void Quadtree::getStatsOfChildren(QuadtreeNode* node){
+	StatsNode* stats = static_cast<StatsNode*>(node);
+	for (int c = 0; c < 4; c++){
+		stats->sum[c] = node->nwChild->sourceSum(c) + node->neChild->sourceSum(c) +
+						node->swChild->sourceSum(c) + node->seChild->sourceSum(c);
+		stats->sumSq[c] = node->nwChild->sourceSumSq(c) + node->neChild->sourceSumSq(c) +
+						  node->swChild->sourceSumSq(c) + node->seChild->sourceSumSq(c);
+	}
+}
+
+// set the source statistics of child to those of the given quadrant of
+// leaf's block, giving the remainder of the division to quadrant 3
+void Quadtree::setQuarterStats(StatsNode* child, QuadtreeNode const* leaf, int quadrant){
+	for (int c = 0; c < 4; c++){
+		int64_t sum = leaf->sourceSum(c), sumSq = leaf->sourceSumSq(c);
+		child->sum[c] = sum / 4;
+		child->sumSq[c] = sumSq / 4;
+		if (quadrant == 3){
+			child->sum[c] += sum % 4;
+			child->sumSq[c] += sumSq % 4;
+		}
+	}
+}
+
+// return the squared error, over red, green and blue, of the area source
+// pixels of node's block against node's color
+// sum over the block of (p - v)^2 is sumSq - 2 v sum + area v^2
+int64_t Quadtree::leafError(QuadtreeNode const* node, int64_t area) const {
+	int64_t channels[3] = { node->element.red, node->element.green, node->element.blue };
+	int64_t error = 0;
+	for (int c = 0; c < 3; c++){
+		int64_t v = channels[c];
+		error += node->sourceSumSq(c) - 2 * v * node->sourceSum(c) + area * v * v;
+	}
+	return error;
+}
+
 // getPixel (public interface)
 //   - parameters: int x, int y - coordinates of the pixel to be retrieved
 //   - return value: an RGBAPixel representing the desired pixel of the
@@ -170,26 +315,99 @@ uint8_t Quadtree::getAvg(uint8_t n1, uint8_t n2, uint8_t n3, uint8_t n4){
 RGBAPixel Quadtree::getPixel(int x, int y) const
 {
 	if (outOfBound(x, y) || root == NULL) { return RGBAPixel(); }
-	return getPixel(x, y, root, res);
-}
-
-// helper function for getPixel(int x, int y)
-RGBAPixel Quadtree::getPixel(int x, int y, QuadtreeNode* node, int resolution) const {
-	if (!hasChildren(node)) { return node->element; }
-	else {
-		int r = resolution / 2; 	// r is the resolution of region represented by a node's child
-		if (x < r && y < r){
-			return getPixel(x, y, node->nwChild, r);
-		} else if (x < r && y >= r){
-			return getPixel(x, y, node->swChild, r);
-		} else if (x >= r && y < r){
-			return getPixel(x, y, node->neChild, r);
+	int left, top, size;
+	toStored(x, y);
+	return findLeaf(x, y, left, top, size)->element;
+}
+
+/** return the leaf whose block contains (x, y), descending iteratively and
+  * taking the child index at each level straight from the coordinate bits
+  * Pre-condition: root is not NULL and (x, y) is inside the image
+  * @param
+  * x, y - coordinates of the pixel in the stored tree
+  * left, top - set to the coordinates of the leaf block's top-left corner
+  * size - set to the width and height of the leaf's block
+  */
+Quadtree::QuadtreeNode* Quadtree::findLeaf(int x, int y, int& left, int& top, int& size) const {
+	QuadtreeNode* node = root;
+	int half = res / 2;		// resolution of the region represented by node's children
+	while (hasChildren(node)){
+		int quadrant = ((y & half) != 0) << 1 | ((x & half) != 0);
+		node = node->child(quadrant);
+		half >>= 1;
+	}
+	size = half * 2 > 0 ? half * 2 : 1;
+	left = x & ~(size - 1);
+	top = y & ~(size - 1);
+	return node;
+}
+
+// getPixels (public interface)
+//   - parameters: int const * xs, int const * ys - coordinates of the
+//                    pixels to be retrieved
+//                 RGBAPixel * out - where to store the pixels
+//                 size_t count - how many pixels to retrieve
+//   - stores getPixel(xs[i], ys[i]) in out[i] for every i, answering the
+//        queries in Morton order so that consecutive descents share the
+//        path from the root to their lowest common ancestor
+void Quadtree::getPixels(int const* xs, int const* ys, RGBAPixel* out, size_t count) const
+{
+	int levels = 0;
+	while ((1 << levels) < res) levels++;
+
+	// (Morton code, query index) for every query inside the image
+	vector<pair<uint64_t, size_t> > queries;
+	queries.reserve(count);
+	for (size_t i = 0; i < count; i++){
+		if (root == NULL || outOfBound(xs[i], ys[i])){
+			out[i] = RGBAPixel();
 		} else {
-			return getPixel(x, y, node->seChild, r);
+			int x = xs[i], y = ys[i];
+			toStored(x, y);
+			queries.push_back(make_pair(mortonCode(x, y), i));
+		}
+	}
+	sort(queries.begin(), queries.end());
+
+	// path[d] is the node at depth d on the way to the previous query's leaf
+	QuadtreeNode* path[MAX_LEVELS + 1];
+	path[0] = root;
+	int depth = 0;
+	uint64_t previous = 0;
+	for (size_t i = 0; i < queries.size(); i++){
+		uint64_t code = queries[i].first;
+		uint64_t diff = code ^ previous;
+		if (i == 0 || diff != 0){
+			if (diff != 0){
+				// the highest differing bit pair is the first level the paths split at
+				int highest = 63;
+				while (!(diff >> highest)) highest--;
+				depth = min(depth, levels - 1 - highest / 2);
+			}
+			QuadtreeNode* node = path[depth];
+			while (hasChildren(node)){
+				int quadrant = (int) ((code >> (2 * (levels - 1 - depth))) & 3);
+				node = node->child(quadrant);
+				path[++depth] = node;
+			}
+			previous = code;
 		}
+		out[queries[i].second] = path[depth]->element;
 	}
 }
 
+// return the Morton code of (x, y): the bits of y and x interleaved, with
+// y's bit above x's, so that each pair of bits is the quadrant (0 nw, 1 ne,
+// 2 sw, 3 se) to descend into at one level
+uint64_t Quadtree::mortonCode(int x, int y){
+	uint64_t code = 0;
+	for (int bit = 0; bit < MAX_LEVELS; bit++){
+		code |= (uint64_t) ((x >> bit) & 1) << (2 * bit);
+		code |= (uint64_t) ((y >> bit) & 1) << (2 * bit + 1);
+	}
+	return code;
+}
+
 // return true if given node has children (a node can have either zero or four children)
 bool Quadtree::hasChildren(QuadtreeNode* node) const {
 	return node->nwChild != NULL;
@@ -213,6 +431,188 @@ PNG Quadtree::decompress() const
 	return img;
 }
 
+// decompress (public interface)
+//   - parameters: int numThreads - how many threads to use, including the
+//                    calling thread
+//   - return value: a PNG object representing this quadtree's underlying
+//        bitmap
+//   - constructs and returns this quadtree's underlying bitmap, filling
+//        disjoint blocks of it concurrently
+PNG Quadtree::decompress(int numThreads) const
+{
+	if (root == NULL) return PNG();
+	// more threads than the hardware runs at once only add overhead
+	unsigned int cores = thread::hardware_concurrency();
+	if (cores > 0 && (unsigned int) numThreads > cores) numThreads = (int) cores;
+	if (numThreads < 2) return decompress();
+
+	// aim for at least eight blocks per thread
+	int depth = 0;
+	while (((int64_t) 1 << (2 * depth)) < 8 * (int64_t) numThreads && (res >> depth) > 1) depth++;
+	vector<DecompressTask> tasks;
+	collectTasks(tasks, res, 0, 0, root, depth);
+	if ((size_t) numThreads > tasks.size()) numThreads = (int) tasks.size();
+
+	PNG img(res, res);
+	atomic<size_t> next(0);
+	auto work = [this, &img, &tasks, &next]() {
+		for (size_t i = next++; i < tasks.size(); i = next++){
+			DecompressTask const& task = tasks[i];
+			transform(img, task.resolution, task.x, task.y, task.node);
+		}
+	};
+
+	// reserve first, so that push_back cannot throw and destroy a thread
+	// that is still running
+	vector<thread> threads;
+	threads.reserve(numThreads - 1);
+	try {
+		for (int i = 1; i < numThreads; i++){
+			threads.push_back(thread(work));
+		}
+	} catch (system_error const&){
+		// the threads that did start share the work with this one
+	}
+	work();
+	for (size_t i = 0; i < threads.size(); i++){
+		threads[i].join();
+	}
+	return img;
+}
+
+// decompress (public interface)
+//   - parameters: int x, int y - coordinates of the window's upper-left corner
+//                 int width, int height - size of the window
+//   - return value: a width by height PNG holding that window of this
+//        quadtree's underlying bitmap
+//   - visits only the nodes whose blocks intersect the window
+PNG Quadtree::decompress(int x, int y, int width, int height) const
+{
+	if (width < 1 || height < 1) return PNG();
+	PNG img(width, height);
+	decompress(img, x, y);
+	return img;
+}
+
+// decompress (public interface)
+//   - parameters: PNG & target - the image to fill
+//                 int x, int y - coordinates of the window's upper-left corner
+//   - fills target with the window of this quadtree's underlying bitmap
+//        that has target's size and its upper-left corner at (x, y)
+void Quadtree::decompress(PNG& target, int x, int y) const
+{
+	int width = target.width();
+	int height = target.height();
+	if (root == NULL || x < 0 || y < 0 || x + width > res || y + height > res){
+		// some of the window is outside the image
+		fillBlock(target, 0, 0, width, height, RGBAPixel());
+	}
+	if (root != NULL){
+		transformWindow(target, x, y, res, 0, 0, root);
+	}
+}
+
+/** helper function of decompress(PNG& target, int x, int y)
+ * fill the part of target that node's block covers
+ * @param
+ * target - the image to fill
+ * windowX, windowY - coordinates, in the tree, of target's upper-left corner
+ * resolution - the resolution of the region represented by node
+ * x - x-coordinate of top-left corner of the region represented by node
+ * y - y-coordinate of top-left corner of the region represented by node
+ * node - current node in Quadtree
+ */
+void Quadtree::transformWindow(PNG& target, int windowX, int windowY, int resolution,
+							   int x, int y, QuadtreeNode* node) const {
+	// the intersection of node's block and the window, in tree coordinates
+	int left = max(x, windowX);
+	int top = max(y, windowY);
+	int right = min(x + resolution, windowX + (int) target.width());
+	int bottom = min(y + resolution, windowY + (int) target.height());
+	if (left >= right || top >= bottom) return;
+
+	if (!hasChildren(node)){
+		fillBlock(target, left - windowX, top - windowY, right - left, bottom - top, node->element);
+	} else {
+		int childResolution = resolution / 2;
+		transformWindow(target, windowX, windowY, childResolution, x, y, childAt(node, 0));
+		transformWindow(target, windowX, windowY, childResolution, x+childResolution, y, childAt(node, 1));
+		transformWindow(target, windowX, windowY, childResolution, x, y+childResolution, childAt(node, 2));
+		transformWindow(target, windowX, windowY, childResolution, x+childResolution, y+childResolution, childAt(node, 3));
+	}
+}
+
+// decompressLevel (public interface)
+//   - parameters: int k - how many times to halve the resolution
+//   - return value: this quadtree's underlying bitmap scaled down to
+//        (res >> k) by (res >> k), using the averages stored in the
+//        interior nodes
+PNG Quadtree::decompressLevel(int k) const
+{
+	if (root == NULL) return PNG();
+	int scale = 1;
+	while (k > 0 && scale < res){
+		scale *= 2;
+		k--;
+	}
+	PNG img(res / scale, res / scale);
+	transformLevel(img, scale, res, 0, 0, root);
+	return img;
+}
+
+/** helper function of decompressLevel(int k)
+ * fill the part of img covered by node's block, one pixel of img for
+ * every scale by scale block of the tree
+ * @param
+ * img - the downscaled image to fill
+ * scale - how many tree pixels wide one pixel of img is
+ * resolution - the resolution of the region represented by node
+ * x - x-coordinate of top-left corner of the region represented by node
+ * y - y-coordinate of top-left corner of the region represented by node
+ * node - current node in Quadtree
+ */
+void Quadtree::transformLevel(PNG& img, int scale, int resolution, int x, int y, QuadtreeNode* node) const {
+	if (!hasChildren(node) || resolution <= scale){
+		int size = resolution / scale;
+		fillBlock(img, x / scale, y / scale, size, size, node->element);
+	} else {
+		int childResolution = resolution / 2;
+		transformLevel(img, scale, childResolution, x, y, childAt(node, 0));
+		transformLevel(img, scale, childResolution, x+childResolution, y, childAt(node, 1));
+		transformLevel(img, scale, childResolution, x, y+childResolution, childAt(node, 2));
+		transformLevel(img, scale, childResolution, x+childResolution, y+childResolution, childAt(node, 3));
+	}
+}
+
+/** helper function of decompress(int numThreads)
+ * appends to tasks the nodes depth levels below node, or the leaves
+ * above that level
+ * @param
+ * tasks - the list of blocks to fill
+ * resolution - the resolution of the region represented by node
+ * x - x-coordinate of top-left corner of the region represented by node
+ * y - y-coordinate of top-left corner of the region represented by node
+ * node - current node in Quadtree
+ * depth - how many more levels to descend
+ */
+void Quadtree::collectTasks(vector<DecompressTask>& tasks, int resolution, int x, int y,
+							QuadtreeNode* node, int depth) const {
+	if (depth == 0 || !hasChildren(node)){
+		DecompressTask task;
+		task.node = node;
+		task.x = x;
+		task.y = y;
+		task.resolution = resolution;
+		tasks.push_back(task);
+	} else {
+		int childResolution = resolution / 2;
+		collectTasks(tasks, childResolution, x, y, childAt(node, 0), depth - 1);
+		collectTasks(tasks, childResolution, x+childResolution, y, childAt(node, 1), depth - 1);
+		collectTasks(tasks, childResolution, x, y+childResolution, childAt(node, 2), depth - 1);
+		collectTasks(tasks, childResolution, x+childResolution, y+childResolution, childAt(node, 3), depth - 1);
+	}
+}
+
 /** helper function of decompress()
  * transform a PNG img into the PNG image represented by this QuadTree
  * @param
@@ -224,47 +624,794 @@ PNG Quadtree::decompress() const
  */
 void Quadtree::transform (PNG& source, int resolution, int x, int y, QuadtreeNode* node) const {
 	if (!hasChildren(node)){
-		RGBAPixel newPixel = node->element;
-		for (int i = 0; i < resolution; i++){
-			for (int j = 0; j < resolution; j++){
-				RGBAPixel* pixelPtr = source(x+i, y+j);
-				*pixelPtr = newPixel;
+		fillBlock(source, x, y, resolution, resolution, node->element);
+	} else {
+		int childResolution = resolution / 2;
+		transform(source, childResolution, x, y, childAt(node, 0));
+		transform(source, childResolution, x+childResolution, y, childAt(node, 1));
+		transform(source, childResolution, x, y+childResolution, childAt(node, 2));
+		transform(source, childResolution, x+childResolution, y+childResolution, childAt(node, 3));
+	}
+}
+
+
+/** fill a block of img with one color, row by row, writing straight into
+ * the pixel rows rather than going through PNG::operator()
+ * @param
+ * img - the image to fill, which must contain the whole block
+ * x - x-coordinate of top-left corner of the block
+ * y - y-coordinate of top-left corner of the block
+ * width, height - size of the block
+ * color - the color to fill the block with
+ */
+void Quadtree::fillBlock(PNG& img, int x, int y, int width, int height, RGBAPixel const& color) const {
+	if (width == (int) img.width()){
+		// whole rows are contiguous, so the block is one run
+		fill_n(img.row(y), (size_t) width * height, color);
+	} else {
+		for (int j = 0; j < height; j++){
+			fill_n(img.row(y + j) + x, width, color);
+		}
+	}
+}
+
+// decompressTo (public interface)
+//   - parameters: int width, int height - size of the output image
+//                 Filter filter - NEAREST or BILINEAR
+//   - return value: this quadtree's underlying bitmap resampled to width by
+//        height
+//   - reads the tree at the level whose blocks are closest to, but no
+//        larger than, one output pixel, and builds the output one scanline
+//        at a time from at most two rows of that level
+PNG Quadtree::decompressTo(int width, int height, Filter filter) const
+{
+	if (root == NULL || width < 1 || height < 1) return PNG();
+
+	// read the tree at a coarser level only when both axes shrink by that much
+	int scale = 1;
+	while (scale * 2 <= res / width && scale * 2 <= res / height) scale *= 2;
+	int levelRes = res / scale;
+	double stepX = (double) levelRes / width;
+	double stepY = (double) levelRes / height;
+
+	// for every output column, the level columns it reads and the weight
+	// of the right one
+	vector<int> left(width), right(width);
+	vector<float> weightX(width);
+	for (int i = 0; i < width; i++){
+		if (filter == NEAREST){
+			left[i] = right[i] = min((int) ((i + 0.5) * stepX), levelRes - 1);
+			weightX[i] = 0;
+		} else {
+			double u = (i + 0.5) * stepX - 0.5;
+			int u0 = (int) floor(u);
+			weightX[i] = (float) (u - u0);
+			left[i] = max(u0, 0);
+			right[i] = min(u0 + 1, levelRes - 1);
+		}
+	}
+
+	PNG img(width, height);
+	vector<RGBAPixel> upper(levelRes), lower(levelRes);
+	int upperRow = -1, lowerRow = -1;	// the level rows upper and lower hold
+	for (int j = 0; j < height; j++){
+		int v0, v1;
+		float weightY;
+		if (filter == NEAREST){
+			v0 = v1 = min((int) ((j + 0.5) * stepY), levelRes - 1);
+			weightY = 0;
+		} else {
+			double v = (j + 0.5) * stepY - 0.5;
+			int floorV = (int) floor(v);
+			weightY = (float) (v - floorV);
+			v0 = max(floorV, 0);
+			v1 = min(floorV + 1, levelRes - 1);
+		}
+		if (v0 == lowerRow && v0 != upperRow){
+			// moving down: the old lower row becomes the upper row
+			upper.swap(lower);
+			swap(upperRow, lowerRow);
+		}
+		if (v0 != upperRow){
+			fillRow(upper.data(), v0 * scale, res, 0, 0, root, scale);
+			upperRow = v0;
+		}
+		// with NEAREST, and at the bottom edge, both rows are the same one,
+		// so it is not filled twice
+		if (v1 != v0 && v1 != lowerRow){
+			fillRow(lower.data(), v1 * scale, res, 0, 0, root, scale);
+			lowerRow = v1;
+		}
+		RGBAPixel const* below = v1 == v0 ? upper.data() : lower.data();
+
+		RGBAPixel* out = img.row(j);
+		for (int i = 0; i < width; i++){
+			if (filter == NEAREST){
+				out[i] = upper[left[i]];
+			} else {
+				out[i] = blend(upper[left[i]], upper[right[i]], below[left[i]],
+							   below[right[i]], weightX[i], weightY);
 			}
 		}
+	}
+	return img;
+}
 
-	} else {
-		int childResolution = resolution / 2;
-		transform(source, childResolution, x, y, node->nwChild);
-		transform(source, childResolution, x+childResolution, y, node->neChild);
-		transform(source, childResolution, x, y+childResolution, node->swChild);
-		transform(source, childResolution, x+childResolution, y+childResolution, node->seChild);
+/* return the bilinear blend of four pixels
+ * @param
+ * nw, ne, sw, se - the pixels at the corners of the cell
+ * fx - how far across the cell, from 0 (west) to 1 (east), to sample
+ * fy - how far down the cell, from 0 (north) to 1 (south), to sample
+ */
+RGBAPixel Quadtree::blend(RGBAPixel const& nw, RGBAPixel const& ne, RGBAPixel const& sw,
+						  RGBAPixel const& se, float fx, float fy){
+	float wnw = (1 - fx) * (1 - fy), wne = fx * (1 - fy);
+	float wsw = (1 - fx) * fy, wse = fx * fy;
+	return RGBAPixel(
+		(uint8_t) (wnw * nw.red + wne * ne.red + wsw * sw.red + wse * se.red + 0.5f),
+		(uint8_t) (wnw * nw.green + wne * ne.green + wsw * sw.green + wse * se.green + 0.5f),
+		(uint8_t) (wnw * nw.blue + wne * ne.blue + wsw * sw.blue + wse * se.blue + 0.5f),
+		(uint8_t) (wnw * nw.alpha + wne * ne.alpha + wsw * sw.alpha + wse * se.alpha + 0.5f));
+}
+
+// boxBlur (public interface)
+//   - parameters: int radius - how far the box extends on each side of a
+//                    pixel
+//   - return value: this quadtree's underlying bitmap, box filtered
+//   - filters only the tiles that leaf boundaries pass through
+PNG Quadtree::boxBlur(int radius) const
+{
+	int radii[1] = { max(radius, 0) };
+	return blur(radii, 1);
+}
+
+// gaussianBlur (public interface)
+//   - parameters: double sigma - the standard deviation of the Gaussian
+//   - return value: this quadtree's underlying bitmap, filtered with three
+//        box filters that approximate the Gaussian
+// The box widths are the odd widths w and w + 2 around the ideal width
+// sqrt(12 sigma^2 / 3 + 1), mixed so that the variances, (w^2 - 1) / 12
+// each, add up to sigma^2 (P. Kovesi, "Fast almost-Gaussian filtering").
+PNG Quadtree::gaussianBlur(double sigma) const
+{
+	int radii[3] = { 0, 0, 0 };
+	if (sigma > 0){
+		int lower = (int) sqrt(4 * sigma * sigma + 1);
+		if (lower % 2 == 0) lower--;
+		int upper = lower + 2;
+		double lowerPasses = (12 * sigma * sigma - 3.0 * lower * lower - 12.0 * lower - 9) /
+							 (-4.0 * lower - 4);
+		int lowerCount = min(max((int) round(lowerPasses), 0), 3);
+		for (int i = 0; i < 3; i++){
+			radii[i] = ((i < lowerCount ? lower : upper) - 1) / 2;
+		}
+	}
+	return blur(radii, 3);
+}
+
+// helper function of boxBlur() and gaussianBlur(); filter the image with
+// passes box filters in turn
+PNG Quadtree::blur(int const* radii, int passes) const {
+	if (root == NULL) return PNG();
+	int margin = 0;
+	for (int i = 0; i < passes; i++){
+		margin += radii[i];
+	}
+	if (margin == 0) return decompress();
+
+	// each filtered tile decompresses a window margin wider on every side;
+	// keeping the tiles at least four times the margin bounds that window
+	// at (1.5 tile)^2, so a tile costs a constant factor over its own area
+	// and neighbouring windows overlap by a bounded fraction
+	int tile = BLUR_TILE;
+	while (tile < res && tile < 4 * (int64_t) margin) tile *= 2;
+	if (tile > res) tile = res;
+	int tiles = res / tile;
+	PNG result(res, res);
+	vector<bool> done((size_t) tiles * tiles, false);
+
+	// every pixel of a tile at least margin inside a leaf is averaged over
+	// that leaf alone; past the edges of the image the leaf's own edge
+	// pixels are repeated, so those sides need no margin
+	for (LeafIterator it(*this), end; it != end; ++it){
+		Leaf const& leaf = *it;
+		if (leaf.size < tile) continue;
+		int left = leaf.x == 0 ? 0 : leaf.x + margin;
+		int top = leaf.y == 0 ? 0 : leaf.y + margin;
+		int right = leaf.x + leaf.size == res ? res : leaf.x + leaf.size - margin;
+		int bottom = leaf.y + leaf.size == res ? res : leaf.y + leaf.size - margin;
+		for (int ty = (top + tile - 1) / tile; ty < bottom / tile; ty++){
+			for (int tx = (left + tile - 1) / tile; tx < right / tile; tx++){
+				done[(size_t) ty * tiles + tx] = true;
+				fillBlock(result, tx * tile, ty * tile, tile, tile, leaf.color);
+			}
+		}
+	}
+
+	for (int ty = 0; ty < tiles; ty++){
+		for (int tx = 0; tx < tiles; tx++){
+			if (!done[(size_t) ty * tiles + tx]){
+				blurTile(result, tx * tile, ty * tile, tile, radii, passes, margin);
+			}
+		}
+	}
+	return result;
+}
+
+// helper function of blur(); fill one tile of result, decompressing only
+// the tile and the margin around it
+// Each pass leaves the window it filters smaller by its radius, so the
+// last pass leaves exactly the tile.
+void Quadtree::blurTile(PNG& result, int x, int y, int size, int const* radii,
+						int passes, int margin) const {
+	int left = max(x - margin, 0);
+	int top = max(y - margin, 0);
+	PNG source(min(x + size + margin, res) - left, min(y + size + margin, res) - top);
+	decompress(source, left, top);
+
+	for (int i = 0; i < passes; i++){
+		margin -= radii[i];
+		int nextLeft = max(x - margin, 0);
+		int nextTop = max(y - margin, 0);
+		PNG next(min(x + size + margin, res) - nextLeft, min(y + size + margin, res) - nextTop);
+		boxPass(source, left, top, next, nextLeft, nextTop, radii[i]);
+		source = next;
+		left = nextLeft;
+		top = nextTop;
+	}
+
+	for (int j = 0; j < size; j++){
+		copy(source.row(j), source.row(j) + size, result.row(y + j) + x);
+	}
+}
+
+// helper function of blurTile(); fill dst with the box filtered image from
+// src, filtering the rows and then the columns with running sums
+void Quadtree::boxPass(PNG const& src, int srcX, int srcY, PNG& dst, int dstX, int dstY, int radius) const {
+	int width = dst.width();
+	int height = dst.height();
+	int top = max(dstY - radius, 0);
+	int bottom = min(dstY + height + radius, res);
+
+	// the sum along each row of src of the box around each column of dst
+	vector<int32_t> rowSums((size_t) (bottom - top) * width * 4);
+	for (int y = top; y < bottom; y++){
+		RGBAPixel const* row = src.row(y - srcY);
+		int32_t* sums = &rowSums[(size_t) (y - top) * width * 4];
+		int32_t sum[4] = { 0, 0, 0, 0 };
+		for (int k = -radius; k <= radius; k++){
+			RGBAPixel const& p = row[clampToImage(dstX + k) - srcX];
+			sum[0] += p.red; sum[1] += p.green; sum[2] += p.blue; sum[3] += p.alpha;
+		}
+		for (int i = 0; i < width; i++){
+			copy(sum, sum + 4, sums + 4 * i);
+			if (i + 1 < width){
+				RGBAPixel const& in = row[clampToImage(dstX + i + radius + 1) - srcX];
+				RGBAPixel const& out = row[clampToImage(dstX + i - radius) - srcX];
+				sum[0] += in.red - out.red;
+				sum[1] += in.green - out.green;
+				sum[2] += in.blue - out.blue;
+				sum[3] += in.alpha - out.alpha;
+			}
+		}
+	}
+
+	// the sum down each column of those sums, slid from row to row of dst
+	int64_t area = (int64_t) (2 * radius + 1) * (2 * radius + 1);
+	vector<int64_t> sums((size_t) width * 4, 0);
+	for (int k = -radius; k <= radius; k++){
+		int32_t const* row = &rowSums[(size_t) (clampToImage(dstY + k) - top) * width * 4];
+		for (int n = 0; n < width * 4; n++){
+			sums[n] += row[n];
+		}
 	}
+	for (int j = 0; j < height; j++){
+		RGBAPixel* out = dst.row(j);
+		for (int i = 0; i < width; i++){
+			int64_t const* s = &sums[4 * i];
+			out[i] = RGBAPixel((s[0] + area / 2) / area, (s[1] + area / 2) / area,
+							   (s[2] + area / 2) / area, (s[3] + area / 2) / area);
+		}
+		if (j + 1 < height){
+			int32_t const* in = &rowSums[(size_t) (clampToImage(dstY + j + radius + 1) - top) * width * 4];
+			int32_t const* gone = &rowSums[(size_t) (clampToImage(dstY + j - radius) - top) * width * 4];
+			for (int n = 0; n < width * 4; n++){
+				sums[n] += in[n] - gone[n];
+			}
+		}
+	}
+}
+
+// return the coordinate of the pixel in the image nearest to value
+int Quadtree::clampToImage(int value) const {
+	return value < 0 ? 0 : (value >= res ? res - 1 : value);
+}
+
+// writeToFile (public interface)
+//   - parameters: string const & file_name - name of the file to write to
+//   - return value: whether the file was written successfully
+//   - writes this quadtree's underlying bitmap to a PNG file, generating
+//        each row from the tree instead of decompressing the whole image
+bool Quadtree::writeToFile(string const& file_name) const
+{
+	if (root == NULL) return PNG().writeToFile(file_name);
+	int nextChange = 0;	// first row at which the buffer must be refilled
+	return PNG::writeToFile(file_name, res, res,
+		[this, &nextChange](size_t y, RGBAPixel* buffer) -> RGBAPixel const* {
+			if ((int) y >= nextChange){
+				nextChange = fillRow(buffer, y, res, 0, 0, root, 1);
+			}
+			return buffer;
+		});
 }
 
+/** helper function of writeToFile() and decompressTo()
+ * fill the part of row y that lies in node's block, and return the first
+ * row after y that differs from row y within that block
+ * @param
+ * row - the row of pixels to fill, one pixel for every scale tree pixels
+ * y - the row being filled, in tree pixels, which must cross node's block
+ * resolution - the resolution of the region represented by node
+ * x - x-coordinate of top-left corner of the region represented by node
+ * top - y-coordinate of top-left corner of the region represented by node
+ * node - current node in Quadtree
+ * scale - how many tree pixels wide one pixel of row is; nodes this size
+ *    are not descended into
+ */
+int Quadtree::fillRow(RGBAPixel* row, int y, int resolution, int x, int top,
+					  QuadtreeNode* node, int scale) const {
+	if (!hasChildren(node) || resolution <= scale){
+		fill_n(row + x / scale, max(resolution / scale, 1), node->element);
+		return top + resolution;
+	}
+	int childResolution = resolution / 2;
+	if (y < top + childResolution){
+		return min(fillRow(row, y, childResolution, x, top, childAt(node, 0), scale),
+				   fillRow(row, y, childResolution, x+childResolution, top, childAt(node, 1), scale));
+	} else {
+		int childTop = top + childResolution;
+		return min(fillRow(row, y, childResolution, x, childTop, childAt(node, 2), scale),
+				   fillRow(row, y, childResolution, x+childResolution, childTop, childAt(node, 3), scale));
+	}
+}
 
 // clockwiseRotate (public interface)
 //   - parameters: none
 //   - transforms this quadtree into a quadtree representing the same
 //        bitmap, rotated 90 degrees clockwise
 void Quadtree::clockwiseRotate() {
-	if (root != NULL){
-		clockwiseRotate(root);
+	reorient(ROTATE_CW);
+}
+
+// counterClockwiseRotate (public interface)
+//   - parameters: none
+//   - transforms this quadtree into a quadtree representing the same
+//        bitmap, rotated 90 degrees counter-clockwise
+void Quadtree::counterClockwiseRotate() {
+	reorient(ROTATE_CCW);
+}
+
+// rotate180 (public interface)
+//   - parameters: none
+//   - transforms this quadtree into a quadtree representing the same
+//        bitmap, rotated 180 degrees
+void Quadtree::rotate180() {
+	reorient(ROTATE_180);
+}
+
+// flipHorizontal (public interface)
+//   - parameters: none
+//   - transforms this quadtree into a quadtree representing the same
+//        bitmap, mirrored left to right
+void Quadtree::flipHorizontal() {
+	reorient(MIRROR_X);
+}
+
+// flipVertical (public interface)
+//   - parameters: none
+//   - transforms this quadtree into a quadtree representing the same
+//        bitmap, mirrored top to bottom
+void Quadtree::flipVertical() {
+	reorient(MIRROR_Y);
+}
+
+// transpose (public interface)
+//   - parameters: none
+//   - transforms this quadtree into a quadtree representing the same
+//        bitmap, mirrored in its main diagonal
+void Quadtree::transpose() {
+	reorient(TRANSPOSE);
+}
+
+// extractQuadrant (public interface)
+//   - parameters: int quadrant - 0 for nw, 1 for ne, 2 for sw, 3 for se,
+//                    in the image
+//   - return value: a Quadtree of half the resolution representing that
+//        quadrant of this quadtree's underlying bitmap
+//   - moves the quadrant's subtree into the returned tree, and leaves a
+//        leaf with the subtree's color and statistics in its place
+Quadtree Quadtree::extractQuadrant(int quadrant)
+{
+	Quadtree part;
+	if (root == NULL || res < 2 || quadrant < 0 || quadrant > 3) return part;
+	commitStash();
+	part.res = res / 2;
+	part.orientation = orientation;
+	if (!hasChildren(root)){
+		// a leaf's statistics are spread evenly over its block
+		StatsNode* quarter = new StatsNode(root->element);
+		setQuarterStats(quarter, root, quadrant);
+		part.root = quarter;
+		part.refreshHashes();
+		return part;
+	}
+	QuadtreeNode*& slot = root->childSlot(ORIENTATIONS[orientation][quadrant]);
+	root->hashStale = true;
+	part.root = slot;
+	StatsNode* leaf = new StatsNode(part.root->element);
+	for (int c = 0; c < 4; c++){
+		leaf->sum[c] = part.root->sourceSum(c);
+		leaf->sumSq[c] = part.root->sourceSumSq(c);
+	}
+	slot = leaf;
+	// the new leaf may match its siblings
+	mergeIdenticalChildren(root);
+	refreshHashes();
+	return part;
+}
+
+// compose (public interface)
+//   - parameters: Quadtree && nw, ne, sw, se - the quadrants of the new
+//                    tree's image, four distinct, non-empty trees of
+//                    equal resolution
+//   - return value: a Quadtree of twice the resolution whose root has the
+//        four trees' roots as its children
+//   - empties the four trees
+Quadtree Quadtree::compose(Quadtree&& nw, Quadtree&& ne, Quadtree&& sw, Quadtree&& se)
+{
+	Quadtree result;
+	Quadtree* parts[4] = { &nw, &ne, &sw, &se };
+	bool sameOrientation = true;
+	for (int q = 0; q < 4; q++){
+		if (parts[q]->root == NULL || parts[q]->res != nw.res) return result;
+		// one root cannot be moved into two places
+		for (int other = 0; other < q; other++){
+			if (parts[other] == parts[q]) return result;
+		}
+		sameOrientation = sameOrientation && parts[q]->orientation == nw.orientation;
+	}
+
+	// the orientation applies at every level, so the new root can only
+	// take one on if all four children share it
+	result.orientation = sameOrientation ? nw.orientation : IDENTITY;
+	result.res = 2 * nw.res;
+	result.root = new StatsNode();
+	for (int q = 0; q < 4; q++){
+		Quadtree& part = *parts[q];
+		part.commitStash();
+		if (!sameOrientation) part.materialize();
+		result.root->childSlot(ORIENTATIONS[result.orientation][q]) = part.root;
+		part.root = NULL;
+		part.res = 0;
+		part.orientation = IDENTITY;
+	}
+	result.getAvgPixelOfChildren(result.root);
+	result.getStatsOfChildren(result.root);
+	result.mergeIdenticalChildren(result.root);
+	result.refreshHashes();
+	return result;
+}
+
+// composite (public interface)
+//   - parameters: Quadtree const & over - the image to lay on top, of the
+//                    same resolution
+//                 BlendMode mode - how to blend its colors with ours
+//   - composites over on top of this quadtree's underlying bitmap,
+//        traversing both trees together and only subdividing where over
+//        has detail that this tree lacks
+void Quadtree::composite(Quadtree const& over, BlendMode mode)
+{
+	if (root == NULL || over.root == NULL || over.res != res) return;
+	if (&over == this){
+		Quadtree copy(over);
+		composite(copy, mode);
+		return;
 	}
+	commitStash();
+	composite(root, over.root, over, (int64_t) res * res, mode);
+	refreshHashes();
 }
 
-// helper function for clockwiseRotate()
-void Quadtree::clockwiseRotate(QuadtreeNode*& node){
+// helper function of composite()
+void Quadtree::composite(QuadtreeNode* node, QuadtreeNode const* over,
+						 Quadtree const& overTree, int64_t area, BlendMode mode){
+	if (over->nwChild == NULL){
+		compositeColor(node, over->element, area, mode);
+		return;
+	}
+	if (!hasChildren(node)){
+		// over has detail here, so give node four children to receive it
+		for (int q = 0; q < 4; q++){
+			StatsNode* child = new StatsNode(node->element);
+			setQuarterStats(child, node, q);
+			node->childSlot(q) = child;
+		}
+	}
+	// pair the children that show the same quadrant of the image
+	for (int q = 0; q < 4; q++){
+		composite(childAt(node, q), overTree.childAt(over, q), overTree, area / 4, mode);
+	}
+	getAvgPixelOfChildren(node);
+	getStatsOfChildren(node);
+	propagateHashStale(node);
+	mergeIdenticalChildren(node);
+}
+
+// helper function of composite(); composite the single color color on
+// top of every leaf at or below node, whose block covers area pixels
+void Quadtree::compositeColor(QuadtreeNode* node, RGBAPixel const& color,
+							  int64_t area, BlendMode mode){
+	if (color.alpha == 0) return;
+	if (mode == OVER && color.alpha == 255){
+		pruneChildren(node);
+		node->element = color;
+		node->hashStale = true;
+		setLeafStats(node, area);
+	} else if (!hasChildren(node)){
+		node->element = compositePixel(node->element, color, mode);
+		setLeafStats(node, area);
+		node->hashStale = true;
+	} else {
+		compositeColor(node->nwChild, color, area / 4, mode);
+		compositeColor(node->neChild, color, area / 4, mode);
+		compositeColor(node->swChild, color, area / 4, mode);
+		compositeColor(node->seChild, color, area / 4, mode);
+		getAvgPixelOfChildren(node);
+		getStatsOfChildren(node);
+		node->hashStale = true;
+		mergeIdenticalChildren(node);
+	}
+}
+
+// return the source-over composite of the overlay color over, blended
+// with mode, on top of base
+// The blended color is mixed with over's own color by base's alpha, so
+// that blending with a transparent pixel leaves over unchanged.
+RGBAPixel Quadtree::compositePixel(RGBAPixel const& base, RGBAPixel const& over,
+								   BlendMode mode){
+	float overAlpha = over.alpha / 255.0f;
+	float baseAlpha = base.alpha / 255.0f;
+	float alpha = overAlpha + baseAlpha * (1 - overAlpha);
+	if (alpha == 0) return RGBAPixel(0, 0, 0, 0);
+
+	uint8_t const baseChannels[3] = { base.red, base.green, base.blue };
+	uint8_t const overChannels[3] = { over.red, over.green, over.blue };
+	uint8_t result[3];
+	for (int c = 0; c < 3; c++){
+		float b = baseChannels[c] / 255.0f;
+		float o = overChannels[c] / 255.0f;
+		float blended = mode == MULTIPLY ? b * o
+					  : mode == SCREEN ? b + o - b * o
+					  : o;
+		float source = (1 - baseAlpha) * o + baseAlpha * blended;
+		float value = (overAlpha * source + baseAlpha * b * (1 - overAlpha)) / alpha;
+		result[c] = (uint8_t) (value * 255 + 0.5f);
+	}
+	return RGBAPixel(result[0], result[1], result[2], (uint8_t) (alpha * 255 + 0.5f));
+}
+
+// helper function of mapColors(); appends the leaves at or below node to
+// leaves, in preorder
+void Quadtree::collectLeaves(QuadtreeNode* node, vector<QuadtreeNode*>& leaves) const {
+	if (!hasChildren(node)){
+		leaves.push_back(node);
+	} else {
+		collectLeaves(node->nwChild, leaves);
+		collectLeaves(node->neChild, leaves);
+		collectLeaves(node->swChild, leaves);
+		collectLeaves(node->seChild, leaves);
+	}
+}
+
+// helper function of mapColors(); after the leaves' colors have changed,
+// reset their statistics and recompute the averages, statistics and hashes
+// above them, merging children that the map made identical
+void Quadtree::refreshAfterMap(QuadtreeNode* node, int64_t area){
+	node->hashStale = true;
+	if (!hasChildren(node)){
+		setLeafStats(node, area);
+		return;
+	}
+	refreshAfterMap(node->nwChild, area / 4);
+	refreshAfterMap(node->neChild, area / 4);
+	refreshAfterMap(node->swChild, area / 4);
+	refreshAfterMap(node->seChild, area / 4);
+	getAvgPixelOfChildren(node);
+	getStatsOfChildren(node);
+	mergeIdenticalChildren(node);
+}
+
+// contentHash (public interface)
+//   - parameters: none
+//   - return value: a hash of this quadtree's underlying bitmap; equal
+//        hashes mean equal images
+//   - combines the hash of the stored tree, read from its root, with the orientation
+//        and resolution it is shown at
+uint64_t Quadtree::contentHash() const
+{
+	if (root == NULL) return 0;
+	return mixHash(mixHash(nodeHash(root) ^ (uint64_t) orientation) ^ (uint64_t) res);
+}
+
+// diff (public interface)
+//   - parameters: Quadtree const & other - the Quadtree to compare with
+//   - return value: the largest aligned blocks, without overlap, in which
+//        every pixel differs between the two images
+//   - traverses both trees together, descending only where both have detail
+vector<Quadtree::Block> Quadtree::diff(Quadtree const& other) const
+{
+	vector<Block> blocks;
+	if (root == NULL && other.root == NULL) return blocks;
+	if (root == NULL || other.root == NULL || res != other.res){
+		Block whole;
+		whole.x = whole.y = 0;
+		whole.size = max(res, other.res);
+		blocks.push_back(whole);
+		return blocks;
+	}
+	if (diff(root, other.root, other, 0, 0, res, blocks)){
+		Block whole;
+		whole.x = whole.y = 0;
+		whole.size = res;
+		blocks.push_back(whole);
+	}
+	return blocks;
+}
+
+// helper function of diff()
+bool Quadtree::diff(QuadtreeNode const* a, QuadtreeNode const* b, Quadtree const& other,
+					int x, int y, int resolution, vector<Block>& blocks) const {
+	if (a->nwChild == NULL && b->nwChild == NULL){
+		return a->element != b->element;
+	}
+	if (orientation == other.orientation && nodeHash(a) == nodeHash(b)) return false;
+	// a leaf is compared as a whole against each child of the other node
+	int half = resolution / 2;
+	bool full[4];
+	size_t start[4];	// where each child's blocks begin in blocks
+	for (int q = 0; q < 4; q++){
+		QuadtreeNode const* aChild = a->nwChild == NULL ? a : childAt(a, q);
+		QuadtreeNode const* bChild = b->nwChild == NULL ? b : other.childAt(b, q);
+		start[q] = blocks.size();
+		full[q] = diff(aChild, bChild, other, x + (q & 1) * half, y + (q >> 1) * half, half, blocks);
+	}
+	if (full[0] && full[1] && full[2] && full[3]) return true;
+
+	// list the children that differ entirely where their blocks would have
+	// been, so that blocks stays in Morton order; going backwards keeps the
+	// earlier start positions valid
+	for (int q = 3; q >= 0; q--){
+		if (!full[q]) continue;
+		Block block;
+		block.x = x + (q & 1) * half;
+		block.y = y + (q >> 1) * half;
+		block.size = half;
+		blocks.insert(blocks.begin() + start[q], block);
+	}
+	return false;
+}
+
+// materialize (public interface)
+//   - parameters: none
+//   - rearranges the nodes, including those in the stash, so that the
+//        stored tree is laid out as the image is, and resets the
+//        orientation to IDENTITY
+void Quadtree::materialize()
+{
+	if (orientation == IDENTITY) return;
+	if (root != NULL) materialize(root);
+	for (size_t i = 0; i < stashed; i++){
+		QuadtreeNode** children = stash[i].children;
+		reorderChildren(children[0], children[1], children[2], children[3]);
+		for (int c = 0; c < 4; c++){
+			materialize(children[c]);
+		}
+	}
+	orientation = IDENTITY;
+	refreshHashes();
+}
+
+// helper function of materialize()
+void Quadtree::materialize(QuadtreeNode* node){
 	if (hasChildren(node)){
-		QuadtreeNode* tempNode = node->nwChild;
-		node->nwChild = node->swChild;
-		node->swChild = node->seChild;
-		node->seChild = node->neChild;
-		node->neChild = tempNode;
-		clockwiseRotate(node->nwChild);
-		clockwiseRotate(node->swChild);
-		clockwiseRotate(node->seChild);
-		clockwiseRotate(node->neChild);
+		reorderChildren(node->nwChild, node->neChild, node->swChild, node->seChild);
+		node->hashStale = true;
+		materialize(node->nwChild);
+		materialize(node->neChild);
+		materialize(node->swChild);
+		materialize(node->seChild);
+	}
+}
+
+// canonicalize (public interface)
+//   - parameters: none
+//   - merges, bottom-up, every node whose four children are leaves of the
+//        same color into a leaf, without changing the image
+void Quadtree::canonicalize()
+{
+	if (root == NULL) return;
+	commitStash();
+	canonicalize(root);
+	refreshHashes();
+}
+
+// helper function of canonicalize()
+void Quadtree::canonicalize(QuadtreeNode* node){
+	if (!hasChildren(node)) return;
+	canonicalize(node->nwChild);
+	canonicalize(node->neChild);
+	canonicalize(node->swChild);
+	canonicalize(node->seChild);
+	propagateHashStale(node);
+	mergeIdenticalChildren(node);
+}
+
+// turn node into a leaf if its four children are leaves of the same color
+// The average of four equal colors is that color, and node's statistics
+// are already the sum of its children's, so only the children go.
+bool Quadtree::mergeIdenticalChildren(QuadtreeNode* node){
+	if (!hasChildren(node) || !hasLeafChildren(node)) return false;
+	RGBAPixel const& color = node->nwChild->element;
+	if (node->neChild->element == color && node->swChild->element == color &&
+		node->seChild->element == color){
+		node->element = color;
+		pruneChildren(node);
+		return true;
+	}
+	return false;
+}
+
+// rearrange four children, given in stored order, into image order
+void Quadtree::reorderChildren(QuadtreeNode*& nw, QuadtreeNode*& ne,
+							   QuadtreeNode*& sw, QuadtreeNode*& se) const {
+	QuadtreeNode* stored[4] = { nw, ne, sw, se };
+	int const* order = ORIENTATIONS[orientation];
+	nw = stored[order[0]];
+	ne = stored[order[1]];
+	sw = stored[order[2]];
+	se = stored[order[3]];
+}
+
+// change the orientation so that the image is transformed by rotation,
+// an Orientation applied on top of the current one
+// The image's quadrant q now shows what its quadrant ORIENTATIONS[rotation][q]
+// showed before, which is the stored child ORIENTATIONS[orientation][that].
+void Quadtree::reorient(int rotation){
+	int order[4];
+	for (int q = 0; q < 4; q++){
+		order[q] = ORIENTATIONS[orientation][ORIENTATIONS[rotation][q]];
 	}
+	for (int o = 0; o < 8; o++){
+		if (equal(order, order + 4, ORIENTATIONS[o])){
+			orientation = o;
+			return;
+		}
+	}
+}
+
+// return node's child shown in the given quadrant (0 nw, 1 ne, 2 sw,
+// 3 se) of node's block in the image
+Quadtree::QuadtreeNode* Quadtree::childAt(QuadtreeNode const* node, int quadrant) const {
+	return node->child(ORIENTATIONS[orientation][quadrant]);
+}
+
+// convert coordinates in the image to coordinates in the stored tree
+// Mirroring every level's quadrants mirrors the whole image, and likewise
+// for transposing, so the orientation maps single pixels the same way.
+void Quadtree::toStored(int& x, int& y) const {
+	if (orientation & TRANSPOSE) swap(x, y);
+	if (orientation & MIRROR_X) x = res - 1 - x;
+	if (orientation & MIRROR_Y) y = res - 1 - y;
 }
 
 // prune (public interface)
@@ -279,66 +1426,81 @@ void Quadtree::clockwiseRotate(QuadtreeNode*& node){
 //        color "stand in for" the colors of all (deleted) leaves beneath it
 void Quadtree::prune(int tolerance)
 {
-	if (root != NULL){
-		prune(tolerance, root);
+	prune<RGBDistance>(tolerance);
+}
+
+// return true if all four children of node are leaves
+// Pre-condition: node must have children
+bool Quadtree::hasLeafChildren(QuadtreeNode* node) const {
+	return !hasChildren(node->nwChild) && !hasChildren(node->neChild) &&
+		   !hasChildren(node->swChild) && !hasChildren(node->seChild);
+}
+
+// delete all descendants of the given node
+void Quadtree::pruneChildren(QuadtreeNode*& node){
+	deleteQuadtree(node->nwChild);
+	deleteQuadtree(node->neChild);
+	deleteQuadtree(node->swChild);
+	deleteQuadtree(node->seChild);
+	node->hashStale = true;
+}
+
+// return the hash of the leaves at or below node; a leaf's is computed from
+// its element, and an interior node's is the stored one unless that is out
+// of date, in which case it is computed, without storing it, from below
+uint64_t Quadtree::nodeHash(QuadtreeNode const* node){
+	if (node->nwChild == NULL){
+		RGBAPixel const& p = node->element;
+		// the extra bit keeps leaf inputs apart from interior ones
+		return mixHash((uint64_t) 1 << 32 | (uint64_t) p.alpha << 24 |
+					   (uint64_t) p.blue << 16 | (uint64_t) p.green << 8 | p.red);
 	}
+	if (!node->hashStale) return static_cast<StatsNode const*>(node)->hash;
+	return childrenHash(node);
 }
 
-// helper function of prune(int tolerance)
-void Quadtree::prune(int tolerance, QuadtreeNode*& node){
-	if (!hasChildren(node)){
-		return;
-	} else {
-		if (isChildrenPrunable(tolerance, node, node)){
-			pruneChildren(node);
-		} else {
-			prune(tolerance, node->nwChild);
-			prune(tolerance, node->neChild);
-			prune(tolerance, node->swChild);
-			prune(tolerance, node->seChild);
-		}
+// return the hash of an interior node, combined from its children's
+uint64_t Quadtree::childrenHash(QuadtreeNode const* node){
+	uint64_t h = 0;
+	for (int q = 0; q < 4; q++){
+		h = mixHash(h ^ nodeHash(node->child(q)));
 	}
+	return h;
 }
 
-/** return true if all children (direct and indirect) of node are prunable
-  * Pre-condition: rootNode must have children
-  * @param
-  * tolerance - see prune(int tolerance)
-  * rootNode - root of a subtree to be pruned
-  * node - current node to be checked whether it is prunable
-  */
-bool Quadtree::isChildrenPrunable(int tolerance, QuadtreeNode*& rootNode, QuadtreeNode*& node) const {
-	if(!hasChildren(node)){
-		// node is a leaf
-		return isPrunable(tolerance, rootNode->element, node->element);
-	} else {
-		bool p1 = isChildrenPrunable(tolerance, rootNode, node->nwChild);
-		bool p2 = isChildrenPrunable(tolerance, rootNode, node->neChild);
-		bool p3 = isChildrenPrunable(tolerance, rootNode, node->swChild);
-		bool p4 = isChildrenPrunable(tolerance, rootNode, node->seChild);
-		return p1 && p2 && p3 && p4;
-	}	
+// bring the stored hash of every out of date node up to date
+void Quadtree::refreshHashes(){
+	if (root != NULL) refreshHashes(root);
 }
 
-// return true if the color difference between avgPixel and nodePixel is no more than tolerance
-bool Quadtree::isPrunable(int tolerance, RGBAPixel avgPixel, RGBAPixel nodePixel) const {
-	int diff = square((int) (avgPixel.red - nodePixel.red)) + 
-			   square((int) (avgPixel.green - nodePixel.green)) + 
-			   square((int) (avgPixel.blue - nodePixel.blue));
-	return diff <= tolerance;
+// helper function of refreshHashes(); an up to date node has only up to
+// date descendants, so only the out of date part of the tree is visited
+void Quadtree::refreshHashes(QuadtreeNode* node){
+	if (!node->hashStale) return;
+	if (hasChildren(node)){
+		refreshHashes(node->nwChild);
+		refreshHashes(node->neChild);
+		refreshHashes(node->swChild);
+		refreshHashes(node->seChild);
+		static_cast<StatsNode*>(node)->hash = childrenHash(node);
+	}
+	node->hashStale = false;
 }
 
-// return square of number n
-int Quadtree::square (int n) const {
-	return n * n;
+// scramble the bits of h (the splitmix64 finalizer)
+uint64_t Quadtree::mixHash(uint64_t h){
+	h += 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
 }
 
-// delete all descendants of the given node
-void Quadtree::pruneChildren(QuadtreeNode*& node){
-	deleteQuadtree(node->nwChild);
-	deleteQuadtree(node->neChild);
-	deleteQuadtree(node->swChild);
-	deleteQuadtree(node->seChild);
+// mark node's hash out of date if any of its children's is
+void Quadtree::propagateHashStale(QuadtreeNode* node){
+	if (node->nwChild->hashStale || node->neChild->hashStale ||
+		node->swChild->hashStale || node->seChild->hashStale){
+		node->hashStale = true;
+	}
 }
 
 
@@ -352,58 +1514,455 @@ void Quadtree::pruneChildren(QuadtreeNode*& node){
 //        tree
 int Quadtree::pruneSize(int tolerance) const
 {
-	if (root == NULL) return 0;
-	return pruneSize(tolerance, root);
+	return pruneSize<RGBDistance>(tolerance);
 }
 
-// helper function of pruneSize(int tolerance)
-int Quadtree::pruneSize(int tolerance, QuadtreeNode* node) const{
-	if (!hasChildren(node)){
-		return 1;
-	} else {
-		if (isChildrenPrunable(tolerance, node, node)){
-			return 1;
-		} else {
-			return pruneSize(tolerance, node->nwChild) +
-				   pruneSize(tolerance, node->neChild) +
-				   pruneSize(tolerance, node->swChild) +
-				   pruneSize(tolerance, node->seChild);
-		}
-	}
-}
-
-
 // idealPrune (public interface)
 //   - parameters: int numLeaves - an integer representing the number of
 //                    leaves we wish the quadtree to have, after pruning
 //   - returns the minimum tolerance such that pruning with that tolerance
 //        would yield a tree with at most numLeaves leaves
 int Quadtree::idealPrune(int numLeaves) const
+{
+	return idealPrune<RGBDistance>(numLeaves);
+}
+
+// reversiblePrune (public interface)
+//   - parameters: int tolerance - see prune(int tolerance)
+//   - prunes as prune(int tolerance) does, but moves the collapsed subtrees
+//        into the stash so that unprune can reattach them
+void Quadtree::reversiblePrune(int tolerance)
+{
+	reversiblePrune<RGBDistance>(tolerance);
+}
+
+// unprune (public interface)
+//   - parameters: int tolerance - the tolerance to restore the tree to
+//   - reattaches the stashed subtrees of every node that would not be
+//        pruned with the given tolerance, and stashes those of every node
+//        that would be
+void Quadtree::unprune(int tolerance)
+{
+	while (stashed > 0 && stash[stashed - 1].threshold > tolerance){
+		stashed--;
+		StashEntry& entry = stash[stashed];
+		QuadtreeNode* node = entry.node;
+		node->nwChild = entry.children[0];
+		node->neChild = entry.children[1];
+		node->swChild = entry.children[2];
+		node->seChild = entry.children[3];
+		invalidateStashPath((int) stashed);
+	}
+	stashUpTo(tolerance);
+	refreshHashes();
+}
+
+// move into the stash the subtrees of every node, not already stashed, that
+// would be pruned with tolerance; the stash is sorted by threshold, so they
+// are the entries after the stashed ones up to the first that is higher
+void Quadtree::stashUpTo(int tolerance){
+	while (stashed < stash.size() && stash[stashed].threshold <= tolerance){
+		StashEntry& entry = stash[stashed];
+		QuadtreeNode* node = entry.node;
+		entry.children[0] = node->nwChild;
+		entry.children[1] = node->neChild;
+		entry.children[2] = node->swChild;
+		entry.children[3] = node->seChild;
+		node->nwChild = node->neChild = node->swChild = node->seChild = NULL;
+		invalidateStashPath((int) stashed);
+		stashed++;
+	}
+}
+
+// mark the hashes of the node of stash entry index and of its ancestors
+// out of date; an ancestor of an out of date node already is, so the walk
+// stops at the first one that is
+void Quadtree::invalidateStashPath(int index){
+	stash[index].node->hashStale = true;
+	for (int i = stash[index].parent; i >= 0 && !stash[i].node->hashStale; i = stash[i].parent){
+		stash[i].node->hashStale = true;
+	}
+}
+
+// make the pruning done by reversiblePrune permanent: delete the stashed
+// subtrees and empty the stash
+void Quadtree::commitStash(){
+	for (size_t i = 0; i < stashed; i++){
+		for (int c = 0; c < 4; c++){
+			deleteQuadtree(stash[i].children[c]);
+		}
+	}
+	stash.clear();
+	stashed = 0;
+	stashPolicy = NULL;
+}
+
+// pruneToMSE (public interface)
+//   - parameters: double maxError - the largest mean squared error, against
+//                    the image this tree was built from, to allow
+//   - collapses the nodes whose children are all leaves, cheapest first,
+//        until the next collapse would take the error above maxError
+void Quadtree::pruneToMSE(double maxError)
+{
+	if (root == NULL) return;
+	collapseGreedily(maxError * 3.0 * res * res, 1);
+}
+
+// pruneToPSNR (public interface)
+//   - parameters: double minPSNR - the smallest peak signal to noise ratio,
+//                    in decibels, to allow
+//   - prunes as pruneToMSE does, with the equivalent error budget
+void Quadtree::pruneToPSNR(double minPSNR)
+{
+	pruneToMSE(255.0 * 255.0 / pow(10.0, minPSNR / 10.0));
+}
+
+// pruneToLeaves (public interface)
+//   - parameters: int numLeaves - the largest number of leaves to leave
+//   - collapses the nodes whose children are all leaves, cheapest first,
+//        until no more than numLeaves leaves remain
+void Quadtree::pruneToLeaves(int numLeaves)
+{
+	if (root == NULL) return;
+	collapseGreedily(numeric_limits<double>::infinity(), numLeaves);
+}
+
+// meanSquaredError (public interface)
+//   - parameters: none
+//   - return value: the mean squared error, over the red, green and blue
+//        samples of every pixel, of this tree's image against the image
+//        the tree was built from
+double Quadtree::meanSquaredError() const
 {
 	if (root == NULL) return 0;
-	return searchTolerance(numLeaves, MIN_TOLERANCE, MAX_TOLERANCE);
+	return totalError(root, (int64_t) res * res) / (3.0 * res * res);
 }
 
+// helper function of meanSquaredError()
+int64_t Quadtree::totalError(QuadtreeNode const* node, int64_t area) const {
+	if (node->nwChild == NULL) return leafError(node, area);
+	int64_t childArea = area / 4;
+	return totalError(node->nwChild, childArea) + totalError(node->neChild, childArea) +
+		   totalError(node->swChild, childArea) + totalError(node->seChild, childArea);
+}
 
-/** helper function of idealPrune()
-  * binary search for the minimum tolerance given numLeaves
+// queryRegionStats (public interface)
+//   - parameters: int x, int y - coordinates of the rectangle's top-left
+//                     corner
+//                 int w, int h - size of the rectangle
+//   - return value: the mean and variance of each channel over the source
+//        pixels in the rectangle, clipped to the image
+//   - combines the sums stored on the nodes, descending only into nodes
+//        that the rectangle partly covers
+Quadtree::RegionStats Quadtree::queryRegionStats(int x, int y, int w, int h) const
+{
+	RegionStats stats;
+	stats.count = 0;
+	fill_n(stats.mean, 4, 0.0);
+	fill_n(stats.variance, 4, 0.0);
+	if (root == NULL) return stats;
+
+	int x0 = max(x, 0), y0 = max(y, 0);
+	int x1 = (int) min((int64_t) x + w, (int64_t) res);
+	int y1 = (int) min((int64_t) y + h, (int64_t) res);
+	if (x0 >= x1 || y0 >= y1) return stats;
+
+	stats.count = (int64_t) (x1 - x0) * (y1 - y0);
+
+	// the rectangle is still a rectangle in the stored tree
+	int cornerX = x1 - 1, cornerY = y1 - 1;
+	toStored(x0, y0);
+	toStored(cornerX, cornerY);
+	double sum[4] = { 0, 0, 0, 0 }, sumSq[4] = { 0, 0, 0, 0 };
+	addRegionStats(root, 0, 0, res, min(x0, cornerX), min(y0, cornerY),
+				   max(x0, cornerX) + 1, max(y0, cornerY) + 1, sum, sumSq);
+	for (int c = 0; c < 4; c++){
+		stats.mean[c] = sum[c] / stats.count;
+		// rounding can take a zero variance slightly negative
+		stats.variance[c] = max(sumSq[c] / stats.count - stats.mean[c] * stats.mean[c], 0.0);
+	}
+	return stats;
+}
+
+// helper function of queryRegionStats()
+void Quadtree::addRegionStats(QuadtreeNode const* node, int x, int y, int resolution,
+							  int x0, int y0, int x1, int y1,
+							  double* sum, double* sumSq) const {
+	int left = max(x, x0), right = min(x + resolution, x1);
+	int top = max(y, y0), bottom = min(y + resolution, y1);
+	int64_t covered = (int64_t) (right - left) * (bottom - top);
+	int64_t area = (int64_t) resolution * resolution;
+	if (covered == area || node->nwChild == NULL){
+		// a partly covered leaf is assumed to be uniform
+		double share = (double) covered / area;
+		for (int c = 0; c < 4; c++){
+			sum[c] += node->sourceSum(c) * share;
+			sumSq[c] += node->sourceSumSq(c) * share;
+		}
+		return;
+	}
+	int half = resolution / 2;
+	for (int q = 0; q < 4; q++){
+		int childX = x + (q % 2) * half, childY = y + (q / 2) * half;
+		if (childX < x1 && childX + half > x0 && childY < y1 && childY + half > y0)
+			addRegionStats(node->child(q), childX, childY, half, x0, y0, x1, y1, sum, sumSq);
+	}
+}
+
+/** collapse nodes whose children are all leaves, the one that adds the
+  * least squared error first
+  * Collapsing a node never changes the cost of collapsing another, so the
+  * costs are computed once, when a node's children have all become leaves.
   * @param
-  * numLeaves - number of leaves we wish the quadtree to have after pruning
-  * minTolerance - minimum tolerance of current level of search
-  * maxTolerance - maximum tolerance of current level of search
+  * errorBudget - largest total squared error the tree may reach
+  * numLeaves - stop once no more than this many leaves remain
   */
-int Quadtree::searchTolerance(int numLeaves, int minTolerance, int maxTolerance) const {
-	int tryTolerance = (minTolerance + maxTolerance) / 2;
-	int numLeavesAfterTry = pruneSize(tryTolerance);
-	if (numLeavesAfterTry <= numLeaves){
-		if (pruneSize(tryTolerance - 1) > numLeaves) {
-			return tryTolerance;
-		} else { 		// tryTolerance is too large
-			return searchTolerance(numLeaves, minTolerance, tryTolerance);
+void Quadtree::collapseGreedily(double errorBudget, int numLeaves){
+	commitStash();
+	vector<CollapseCandidate> candidates;
+	int64_t error = 0;
+	int leaves = collectCandidates(candidates, root, (int64_t) res * res, -1, error);
+
+	// min-heap of (cost of collapsing, index into candidates)
+	typedef pair<int64_t, int> Entry;
+	priority_queue<Entry, vector<Entry>, greater<Entry> > frontier;
+	for (size_t i = 0; i < candidates.size(); i++){
+		if (candidates[i].interiorChildren == 0){
+			frontier.push(Entry(collapseCost(candidates[i]), (int) i));
 		}
-	} else {			// tryTolerance is too small
-		return searchTolerance(numLeaves, tryTolerance, maxTolerance);
 	}
+
+	// once the budget or the leaf count stops the greedy collapses, keep
+	// going only for nodes whose children are identical leaves, which
+	// merge without changing the image
+	while (!frontier.empty()){
+		Entry next = frontier.top();
+		frontier.pop();
+
+		CollapseCandidate& candidate = candidates[next.second];
+		if (leaves > numLeaves && error + next.first <= errorBudget){
+			pruneChildren(candidate.node);
+			error += next.first;
+		} else if (!mergeIdenticalChildren(candidate.node)){
+			continue;
+		}
+		for (int i = candidate.parent; i >= 0 && !candidates[i].node->hashStale; i = candidates[i].parent){
+			candidates[i].node->hashStale = true;
+		}
+		leaves -= 3;
+
+		if (candidate.parent >= 0){
+			CollapseCandidate& parent = candidates[candidate.parent];
+			parent.interiorChildren--;
+			if (parent.interiorChildren == 0){
+				frontier.push(Entry(collapseCost(parent), candidate.parent));
+			}
+		}
+	}
+	refreshHashes();
+}
+
+// return how much collapsing candidate, whose children are all leaves,
+// adds to the squared error of the tree
+int64_t Quadtree::collapseCost(CollapseCandidate const& candidate) const {
+	QuadtreeNode const* node = candidate.node;
+	int64_t childArea = candidate.area / 4;
+	return leafError(node, candidate.area) -
+		   leafError(node->nwChild, childArea) - leafError(node->neChild, childArea) -
+		   leafError(node->swChild, childArea) - leafError(node->seChild, childArea);
+}
+
+// helper function of collapseGreedily(); appends node and its interior
+// descendants to candidates, adds the squared error of the leaves below
+// node to error, and returns the number of leaves below node
+int Quadtree::collectCandidates(vector<CollapseCandidate>& candidates, QuadtreeNode* node,
+								int64_t area, int parent, int64_t& error) const {
+	if (!hasChildren(node)){
+		error += leafError(node, area);
+		return 1;
+	}
+	int index = (int) candidates.size();
+	CollapseCandidate candidate;
+	candidate.node = node;
+	candidate.area = area;
+	candidate.parent = parent;
+	candidate.interiorChildren = 0;
+	candidates.push_back(candidate);
+
+	QuadtreeNode* children[4] = { node->nwChild, node->neChild, node->swChild, node->seChild };
+	int leaves = 0;
+	for (int i = 0; i < 4; i++){
+		if (hasChildren(children[i])) candidates[index].interiorChildren++;
+		leaves += collectCandidates(candidates, children[i], area / 4, index, error);
+	}
+	return leaves;
+}
+
+// Cursor
+//   - parameters: Quadtree const & tree - the tree to look pixels up in
+//   - constructor for the Cursor class; the cursor starts out with no
+//        cached leaf
+Quadtree::Cursor::Cursor(Quadtree const& tree) : tree(&tree), leaf(NULL), left(0), top(0), size(0) {}
+
+// getPixel
+//   - parameters: int x, int y - coordinates of the pixel to be retrieved
+//   - return value: the same pixel as tree.getPixel(x, y)
+//   - answers from the cached leaf when (x, y) falls in its block, and
+//        otherwise descends from the root and caches the leaf it reaches
+RGBAPixel Quadtree::Cursor::getPixel(int x, int y)
+{
+	if (tree->outOfBound(x, y) || tree->root == NULL) { return RGBAPixel(); }
+	tree->toStored(x, y);
+	if (leaf != NULL && (unsigned) (x - left) < (unsigned) size && (unsigned) (y - top) < (unsigned) size){
+		return leaf->element;
+	}
+	leaf = tree->findLeaf(x, y, left, top, size);
+	return leaf->element;
+}
+
+// leaves (public interface)
+//   - parameters: none
+//   - return value: the range of this tree's leaves, for range-based for
+Quadtree::LeafRange Quadtree::leaves() const
+{
+	return LeafRange(*this);
+}
+
+// LeafRange
+//   - parameters: Quadtree const & tree - the tree whose leaves to hold
+//   - constructor for the LeafRange class
+Quadtree::LeafRange::LeafRange(Quadtree const& tree) : tree(&tree) {}
+
+// begin
+//   - return value: an iterator at the first leaf of the tree
+Quadtree::LeafIterator Quadtree::LeafRange::begin() const
+{
+	return LeafIterator(*tree);
+}
+
+// end
+//   - return value: an iterator past the last leaf of the tree
+Quadtree::LeafIterator Quadtree::LeafRange::end() const
+{
+	return LeafIterator();
+}
+
+// LeafIterator
+//   - parameters: none
+//   - constructor for the LeafIterator class; creates an iterator past
+//        the last leaf
+Quadtree::LeafIterator::LeafIterator() : order(ORIENTATIONS[IDENTITY]), depth(-1), resolution(0) {}
+
+// LeafIterator
+//   - parameters: Quadtree const & tree - the tree whose leaves to walk
+//   - constructor for the LeafIterator class; creates an iterator at the
+//        first leaf of tree, or past the last leaf if tree is empty
+Quadtree::LeafIterator::LeafIterator(Quadtree const& tree)
+	: order(ORIENTATIONS[tree.orientation]), depth(-1), resolution(tree.res)
+{
+	if (tree.root == NULL) return;
+	depth = 0;
+	path[0] = tree.root;
+	quadrant[0] = 0;
+	leaf.x = leaf.y = 0;
+	descend();
+}
+
+// operator*
+//   - return value: the current leaf
+Quadtree::Leaf const& Quadtree::LeafIterator::operator*() const
+{
+	return leaf;
+}
+
+// operator->
+//   - return value: a pointer to the current leaf
+Quadtree::Leaf const* Quadtree::LeafIterator::operator->() const
+{
+	return &leaf;
+}
+
+// operator++
+//   - return value: this iterator, advanced to the next leaf
+//   - climbs to the nearest ancestor with a sibling still to visit, moves
+//        to that sibling and descends from it
+Quadtree::LeafIterator& Quadtree::LeafIterator::operator++()
+{
+	while (depth > 0 && quadrant[depth] == 3) depth--;
+	if (depth == 0){
+		depth = -1;
+		return *this;
+	}
+	int q = ++quadrant[depth];
+	path[depth] = path[depth - 1]->child(order[q]);
+	// the parent's block is aligned to twice the child's size
+	int size = resolution >> depth;
+	leaf.x = (leaf.x & ~(2 * size - 1)) + (q & 1) * size;
+	leaf.y = (leaf.y & ~(2 * size - 1)) + (q >> 1) * size;
+	descend();
+	return *this;
+}
+
+// operator++
+//   - return value: a copy of this iterator from before it advanced
+Quadtree::LeafIterator Quadtree::LeafIterator::operator++(int)
+{
+	LeafIterator previous = *this;
+	++*this;
+	return previous;
+}
+
+// operator==
+//   - parameters: LeafIterator const & other - the iterator to compare with
+//   - return value: whether both are at the same leaf, or both past the end
+bool Quadtree::LeafIterator::operator==(LeafIterator const& other) const
+{
+	if (depth != other.depth) return false;
+	return depth < 0 || path[depth] == other.path[depth];
+}
+
+// operator!=
+//   - parameters: LeafIterator const & other - the iterator to compare with
+//   - return value: whether the iterators are at different leaves
+bool Quadtree::LeafIterator::operator!=(LeafIterator const& other) const
+{
+	return !(*this == other);
+}
+
+// helper function of LeafIterator
+void Quadtree::LeafIterator::descend(){
+	QuadtreeNode const* node = path[depth];
+	while (node->nwChild != NULL){
+		node = node->child(order[0]);
+		depth++;
+		path[depth] = node;
+		quadrant[depth] = 0;
+	}
+	leaf.size = resolution >> depth;
+	leaf.color = node->element;
+}
+
+// child
+//   - parameters: int quadrant - 0 for nw, 1 for ne, 2 for sw, 3 for se
+//   - return value: the child of this node in the given quadrant
+Quadtree::QuadtreeNode* Quadtree::QuadtreeNode::child(int quadrant) const
+{
+    QuadtreeNode* const children[4] = { nwChild, neChild, swChild, seChild };
+    return children[quadrant];
+}
+
+// childSlot
+//   - parameters: int quadrant - 0 for nw, 1 for ne, 2 for sw, 3 for se
+//   - return value: a reference to this node's pointer to the child in
+//        the given quadrant
+Quadtree::QuadtreeNode*& Quadtree::QuadtreeNode::childSlot(int quadrant)
+{
+    switch (quadrant) {
+        case 0: return nwChild;
+        case 1: return neChild;
+        case 2: return swChild;
+        default: return seChild;
+    }
 }
 
 // QuadtreeNode
@@ -413,6 +1972,8 @@ int Quadtree::searchTolerance(int numLeaves, int minTolerance, int maxTolerance)
 Quadtree::QuadtreeNode::QuadtreeNode()
 {
     neChild = seChild = nwChild = swChild = NULL;
+    hasStats = false;
+    hashStale = true;
 }
 
 // QuadtreeNode
@@ -424,4 +1985,48 @@ Quadtree::QuadtreeNode::QuadtreeNode(RGBAPixel const& elem)
 {
     element = elem;
     neChild = seChild = nwChild = swChild = NULL;
-}
\ No newline at end of file
+    hasStats = false;
+    hashStale = true;
+}
+
+// sourceSum
+//   - parameters: int channel - 0 for red, 1 for green, 2 for blue,
+//                    3 for alpha
+//   - return value: the sum of that channel over the source pixels of
+//        this node's block
+int64_t Quadtree::QuadtreeNode::sourceSum(int channel) const
+{
+    if (hasStats) return static_cast<StatsNode const*>(this)->sum[channel];
+    uint8_t const channels[4] = { element.red, element.green, element.blue, element.alpha };
+    return channels[channel];
+}
+
+// sourceSumSq
+//   - parameters: int channel - 0 for red, 1 for green, 2 for blue,
+//                    3 for alpha
+//   - return value: the sum of the squares of that channel over the
+//        source pixels of this node's block
+int64_t Quadtree::QuadtreeNode::sourceSumSq(int channel) const
+{
+    if (hasStats) return static_cast<StatsNode const*>(this)->sumSq[channel];
+    uint8_t const channels[4] = { element.red, element.green, element.blue, element.alpha };
+    return (int64_t) channels[channel] * channels[channel];
+}
+
+// StatsNode
+//   - parameters: none
+//   - constructor for the StatsNode class; creates an empty StatsNode,
+//        with all child pointers NULL and its statistics unset
+Quadtree::StatsNode::StatsNode()
+{
+    hasStats = true;
+}
+
+// StatsNode
+//   - parameters: RGBAPixel const & elem - the color of the node
+//   - constructor for the StatsNode class; creates a StatsNode with
+//        element elem, all child pointers NULL and its statistics unset
+Quadtree::StatsNode::StatsNode(RGBAPixel const& elem) : QuadtreeNode(elem)
+{
+    hasStats = true;
+}
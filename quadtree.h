@@ -6,7 +6,16 @@
 #ifndef QUADTREE_H
 #define QUADTREE_H
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <typeinfo>
+#include <vector>
+
 #include "png.h"
+#include "colordistance.h"
+#include "colormap.h"
 
 /**
  * A tree structure that is used to compress PNG images.
@@ -46,6 +55,13 @@ class Quadtree
      */
     Quadtree(Quadtree const& other);
 
+    /**
+     * Move constructor. Takes over the nodes, orientation and stash of the
+     * parameter in O(1) time, and leaves the parameter empty.
+     * @param other The Quadtree to move from
+     */
+    Quadtree(Quadtree&& other);
+
     /**
      * Destructor; frees all memory associated with this Quadtree.
      */
@@ -60,6 +76,15 @@ class Quadtree
      */
     Quadtree const& operator=(Quadtree const& other);
 
+    /**
+     * Move assignment operator; frees memory associated with this Quadtree
+     * and takes over the contents of the parameter, leaving it empty.
+     *
+     * @param other The Quadtree to move from
+     * @return A constant reference to this Quadtree
+     */
+    Quadtree const& operator=(Quadtree&& other);
+
     /**
      * Deletes the current contents of this Quadtree object, then turns
      * it into a Quadtree object representing the upper-left resolution 
@@ -94,6 +119,74 @@ class Quadtree
      */
     RGBAPixel getPixel(int x, int y) const;
 
+    /**
+     * Looks up pixels of a Quadtree, remembering the leaf that the last
+     * lookup ended in. A lookup inside that leaf's block is answered in
+     * O(1), so raster scans and other spatially coherent lookups only
+     * descend the tree when they cross into a new leaf. A Cursor must not
+     * be used after its Quadtree is modified or destroyed.
+     */
+    class Cursor;
+
+    /**
+     * Gets many pixels at once: stores getPixel(xs[i], ys[i]) in out[i]
+     * for every i below count.
+     *
+     * The queries are sorted by their Morton (Z-order) code and answered
+     * in that order, so consecutive queries that lie close together only
+     * descend from their lowest common ancestor instead of from the root.
+     * For large batches of scattered lookups this is much cheaper than
+     * calling getPixel once per coordinate.
+     *
+     * @param xs The x coordinates of the pixels to be retrieved
+     * @param ys The y coordinates of the pixels to be retrieved
+     * @param out Where to store the count retrieved pixels
+     * @param count How many pixels to retrieve
+     */
+    void getPixels(int const* xs, int const* ys, RGBAPixel* out, size_t count) const;
+
+    /**
+     * One leaf of a Quadtree: the size by size block with top-left corner
+     * (x, y), all of whose pixels are color.
+     */
+    class Leaf;
+
+    /**
+     * Walks the leaves of a Quadtree in preorder, visiting the children
+     * of every node in the order northwest, northeast, southwest,
+     * southeast. That is also Morton (Z) order of the leaves' blocks. The
+     * walk keeps its path from the root in a fixed-size array, so it never
+     * allocates and never recurses. An iterator must not be used after its
+     * Quadtree is modified or destroyed.
+     */
+    class LeafIterator;
+
+    /**
+     * The leaves of a Quadtree, as returned by leaves(), for use with
+     * range-based for loops.
+     */
+    class LeafRange;
+
+    /**
+     * Returns the leaves of this Quadtree, so they can be visited with
+     *
+     *     for (Quadtree::Leaf const& leaf : tree.leaves()) { ... }
+     *
+     * An empty Quadtree has no leaves.
+     *
+     * @return The range of this Quadtree's leaves
+     */
+    LeafRange leaves() const;
+
+    /**
+     * Calls visit(leaf) with every leaf of this Quadtree, in the order of
+     * leaves().
+     *
+     * @param visit A function or functor taking a Leaf const &
+     */
+    template <class Visitor>
+    void forEachLeaf(Visitor visit) const;
+
     /**
      * Returns the underlying PNG object represented by the Quadtree.
      *
@@ -111,14 +204,377 @@ class Quadtree
      */
     PNG decompress() const;
 
+    /**
+     * Returns the same image as decompress(), but fills it on numThreads
+     * threads. The tree is cut into blocks that are several times more
+     * numerous than the threads, so that a few detailed blocks do not keep
+     * the other threads waiting, and the threads take blocks until none
+     * remain. Blocks never overlap, so each pixel is written exactly once
+     * and the output does not depend on the scheduling.
+     *
+     * @param numThreads How many threads to use, including the calling
+     *  thread; values below 2 decompress on the calling thread, and values
+     *  above std::thread::hardware_concurrency() or the number of blocks
+     *  are reduced to it. If a thread cannot be started, the threads that
+     *  were share the work.
+     * @return The decompressed PNG image this Quadtree represents
+     */
+    PNG decompress(int numThreads) const;
+
+    /**
+     * Returns a window of the image this Quadtree represents: the width by
+     * height block whose upper-left corner is at (x, y). Only the nodes
+     * whose blocks intersect the window are visited, so the cost depends
+     * on the size of the window, not of the image. Parts of the window
+     * that fall outside the image, or the whole window if this Quadtree is
+     * empty, are filled with the default RGBAPixel.
+     *
+     * @param x The x coordinate of the window's upper-left corner
+     * @param y The y coordinate of the window's upper-left corner
+     * @param width The width of the window
+     * @param height The height of the window
+     * @return The window as a width by height PNG, or the default PNG if
+     *  width or height is not positive
+     */
+    PNG decompress(int x, int y, int width, int height) const;
+
+    /**
+     * Like decompress(int, int, int, int), but fills a caller-provided
+     * image instead of returning a new one. The window is the size of
+     * target, and every pixel of target is overwritten.
+     *
+     * @param target The image to fill
+     * @param x The x coordinate of the window's upper-left corner
+     * @param y The y coordinate of the window's upper-left corner
+     */
+    void decompress(PNG& target, int x, int y) const;
+
+    /**
+     * Returns the image this Quadtree represents, scaled down by a factor
+     * of \f$2^k\f$ in each direction, i.e. a (res >> k) by (res >> k)
+     * image. Every interior node already stores the average color of its
+     * block, so the traversal stops \f$k\f$ levels above the pixels and
+     * never visits the nodes below that level; each output pixel is the
+     * component-wise average that prune would use for that block.
+     *
+     * @param k How many times to halve the resolution; values below 0 are
+     *  treated as 0, and values that would leave less than one pixel give a
+     *  1x1 image of the root's color
+     * @return The downscaled image, or the default PNG if this Quadtree is
+     *  empty
+     */
+    PNG decompressLevel(int k) const;
+
+    /**
+     * How decompressTo computes each output pixel from the tree.
+     */
+    enum Filter
+    {
+        NEAREST, /**< the color at the output pixel's center */
+        BILINEAR /**< a blend of the four samples nearest its center */
+    };
+
+    /**
+     * Returns the image this Quadtree represents, resampled to width by
+     * height pixels. Each output pixel's center is mapped back into the
+     * tree and sampled with the given filter.
+     *
+     * When the output is at least twice smaller than the tree along both
+     * axes, the tree is read at the level of detail that matches the
+     * output scale (as decompressLevel would), so the samples are block
+     * averages rather than single pixels and the deeper nodes are never
+     * visited. The output is built one scanline at a time from at most two
+     * rows of that level; no full-resolution image is made.
+     *
+     * @param width The width of the output image
+     * @param height The height of the output image
+     * @param filter NEAREST or BILINEAR
+     * @return The resampled image, or the default PNG if this Quadtree is
+     *  empty or width or height is not positive
+     */
+    PNG decompressTo(int width, int height, Filter filter) const;
+
+    /**
+     * Returns the image this Quadtree represents, blurred with a box
+     * filter: each pixel becomes the rounded average of the (2 * radius +
+     * 1) by (2 * radius + 1) square around it, with the pixels at the edges
+     * of the image repeated outwards as far as needed.
+     *
+     * The image is handled in square tiles at least 64 and at least four
+     * times radius pixels wide (or the whole image, if that is smaller). A
+     * tile that lies at least radius pixels inside one leaf (not counting
+     * the sides of the leaf along the edges of the image) cannot change,
+     * so it is filled with the leaf's color. Only the other tiles, those
+     * that leaf boundaries pass through, are decompressed with a margin of
+     * radius pixels and filtered with separable running sums. The margin
+     * adds at most 125% to a tile's area, and the running sums cost the
+     * same per pixel whatever the radius, so each of those tiles costs a
+     * constant factor over its area.
+     *
+     * The cost is therefore proportional to the area of the tiles along
+     * the leaf boundaries: about the total boundary length times the tile
+     * width. When the leaves are much larger than the tiles, that is far
+     * less than the area of the image. When they are not, nearly every
+     * tile is filtered, and the cost is a small constant factor over
+     * decompressing the whole image and filtering it.
+     *
+     * @param radius How far the square extends on each side of a pixel;
+     *  values below 1 give the image unchanged
+     * @return The blurred image, or the default PNG if this Quadtree is
+     *  empty
+     */
+    PNG boxBlur(int radius) const;
+
+    /**
+     * Returns the image this Quadtree represents, blurred with an
+     * approximation of a Gaussian filter: three box filters, as boxBlur
+     * applies them, whose sizes are chosen so that together they have the
+     * Gaussian's standard deviation. Tiles are skipped and filtered as in
+     * boxBlur, with a margin of the three radii added together.
+     *
+     * @param sigma The standard deviation of the Gaussian, in pixels;
+     *  values that are not positive give the image unchanged
+     * @return The blurred image, or the default PNG if this Quadtree is
+     *  empty
+     */
+    PNG gaussianBlur(double sigma) const;
+
+    /**
+     * Writes the image this Quadtree represents to a PNG file without
+     * decompressing it first. Each scanline is generated straight from the
+     * tree, by descending only into the nodes whose blocks cross it, and
+     * handed to the PNG encoder; a scanline is only regenerated when it
+     * crosses the top of a new leaf. Memory use is proportional to the
+     * width of the image. An empty Quadtree writes the default 1x1 PNG.
+     *
+     * @param file_name Name of the file to write to.
+     * @return Whether the file was written successfully or not.
+     */
+    bool writeToFile(string const& file_name) const;
+
     /**
      * Rotates the Quadtree object's underlying image clockwise by 90
-     * degrees. (Note that this should be done using pointer
-     * manipulation, not by attempting to swap the element fields of
-     * QuadtreeNodes.  Trust us; it's easier this way.)
+     * degrees.
+     *
+     * This takes O(1) time: the Quadtree records its orientation, one of
+     * the eight rotations and reflections of the square, and only that
+     * record changes. Every function that reads the image applies the
+     * orientation as it descends, so the nodes are never touched.
      */
     void clockwiseRotate();
 
+    /**
+     * Rotates the Quadtree object's underlying image counter-clockwise by
+     * 90 degrees, in O(1) time like clockwiseRotate.
+     */
+    void counterClockwiseRotate();
+
+    /**
+     * Rotates the Quadtree object's underlying image by 180 degrees, in
+     * O(1) time like clockwiseRotate.
+     */
+    void rotate180();
+
+    /**
+     * Mirrors the Quadtree object's underlying image left to right, so
+     * that pixel (x, y) moves to (res - 1 - x, y), in O(1) time like
+     * clockwiseRotate.
+     */
+    void flipHorizontal();
+
+    /**
+     * Mirrors the Quadtree object's underlying image top to bottom, so
+     * that pixel (x, y) moves to (x, res - 1 - y), in O(1) time like
+     * clockwiseRotate.
+     */
+    void flipVertical();
+
+    /**
+     * Transposes the Quadtree object's underlying image, mirroring it in
+     * its main diagonal so that pixel (x, y) moves to (y, x), in O(1) time
+     * like clockwiseRotate.
+     */
+    void transpose();
+
+    /**
+     * Rearranges the nodes so that the Quadtree stores its image in the
+     * orientation it is viewed in, and records that orientation as the
+     * identity. The image does not change. No function requires this, but
+     * it lets traversals skip the orientation lookup. Takes O(n) time for
+     * a tree of n nodes, and does nothing if the orientation already is
+     * the identity.
+     */
+    void materialize();
+
+    /**
+     * Merges every node whose four children are leaves of exactly the same
+     * color into a single leaf of that color, bottom-up, so that merges
+     * can cascade towards the root. The image and the error statistics do
+     * not change; only redundant nodes are removed. Takes O(n) time for a
+     * tree of n nodes. Any stashed pruning is made permanent first.
+     *
+     * mapColors, composite, compose, extractQuadrant, pruneToMSE and
+     * pruneToLeaves merge such nodes as they go, and prune and
+     * reversiblePrune with any tolerance of zero or more remove them along
+     * with the rest. Only a tree straight from a PNG, or one unpruned to a
+     * negative tolerance, still needs this.
+     */
+    void canonicalize();
+
+    /**
+     * Moves one quadrant of the image out into a Quadtree of its own, of
+     * half this Quadtree's resolution, in O(1) time. The subtree itself is
+     * moved, not copied; in its place this Quadtree keeps a single leaf of
+     * the quadrant's average color, as if that subtree had been pruned,
+     * and the root becomes a leaf too if that leaf matches its siblings.
+     * The new Quadtree has this one's orientation. Any stashed pruning is
+     * made permanent first.
+     *
+     * If this Quadtree's root is a leaf, the returned Quadtree is a single
+     * leaf of the same color.
+     *
+     * @param quadrant Which quadrant of the image to extract: 0 for
+     *  northwest, 1 for northeast, 2 for southwest, 3 for southeast
+     * @return The quadrant as a Quadtree, or an empty Quadtree if this one
+     *  is empty, has resolution 1, or quadrant is not between 0 and 3
+     */
+    Quadtree extractQuadrant(int quadrant);
+
+    /**
+     * Builds a Quadtree of twice the resolution whose image has the four
+     * given images as its quadrants, in O(1) time. The four roots are
+     * moved under a new root, and only the new root's average and source
+     * statistics are computed; if the four images are single leaves of one
+     * color, the new root becomes that leaf. The parameters are left empty
+     * and their stashed pruning is made permanent. If they do not all have
+     * the same orientation, each one is materialized first, which takes
+     * time proportional to its size.
+     *
+     * @param nw The Quadtree for the northwest quadrant
+     * @param ne The Quadtree for the northeast quadrant
+     * @param sw The Quadtree for the southwest quadrant
+     * @param se The Quadtree for the southeast quadrant
+     * @return The composed Quadtree, or an empty Quadtree (leaving the
+     *  parameters unchanged) if any of them is empty, their resolutions
+     *  differ, or the same Quadtree is passed more than once
+     */
+    static Quadtree compose(Quadtree&& nw, Quadtree&& ne, Quadtree&& sw, Quadtree&& se);
+
+    /**
+     * How composite combines the color of an overlay pixel with the color
+     * of the pixel beneath it, before the overlay's alpha is applied.
+     * Colors are taken as fractions of 255.
+     */
+    enum BlendMode
+    {
+        OVER,     /**< the overlay's color */
+        MULTIPLY, /**< the product of the two colors, which darkens */
+        SCREEN    /**< one minus the product of their complements,
+                       which lightens */
+    };
+
+    /**
+     * Composites over on top of this Quadtree's image, which must have the
+     * same resolution. Each pixel becomes the source-over composite, with
+     * straight (non-premultiplied) alpha, of the blended overlay color on
+     * the pixel beneath; see BlendMode.
+     *
+     * The two trees are traversed together. Where an overlay leaf is fully
+     * transparent, the subtree beneath it is kept as it is; where it is
+     * fully opaque and mode is OVER, the subtree beneath it is replaced by
+     * one leaf. Nodes are only subdivided where the overlay has detail that
+     * this Quadtree lacks, so the cost scales with the leaf counts of the
+     * two trees rather than with the number of pixels. Nodes whose four
+     * children come out as leaves of one color are merged, as by
+     * canonicalize.
+     *
+     * The composited leaves become this Quadtree's source, for the error
+     * statistics. Any stashed pruning is made permanent first. Nothing
+     * happens if either Quadtree is empty or their resolutions differ.
+     *
+     * @param over The Quadtree whose image to lay on top
+     * @param mode How to blend the overlay's colors with this image's
+     */
+    void composite(Quadtree const& over, BlendMode mode);
+
+    /**
+     * An aligned square block of the image, as returned by diff: the size
+     * by size block with top-left corner (x, y), where size is a power of
+     * two and x and y are multiples of it.
+     */
+    class Block
+    {
+      public:
+        int x;    /**< x coordinate of the block's top-left corner */
+        int y;    /**< y coordinate of the block's top-left corner */
+        int size; /**< width and height of the block */
+    };
+
+    /**
+     * Returns the pixels at which this Quadtree's image and other's
+     * differ, in any of red, green, blue or alpha, as a list of aligned
+     * blocks. The blocks do not overlap, and they are as large as
+     * possible: whenever all four quadrants of an aligned block differ
+     * entirely, the block is listed instead of its quadrants.
+     *
+     * The two trees are traversed together, and a pair of nodes is only
+     * descended into while both have detail there, so the cost is
+     * proportional to the leaves of the two trees rather than to the
+     * number of pixels.
+     *
+     * @param other The Quadtree to compare with
+     * @return The blocks that differ, in Morton order; empty if the images
+     *  are the same. If only one Quadtree is empty, or their resolutions
+     *  differ, the whole of the larger image is one block.
+     */
+    std::vector<Block> diff(Quadtree const& other) const;
+
+    /**
+     * Returns a 64-bit hash of the image this Quadtree represents, for
+     * content addressing. Two Quadtrees with equal hashes represent the
+     * same image (barring a hash collision). The converse only holds for
+     * Quadtrees whose nodes are laid out alike: trees that show the same
+     * image but were pruned differently, or are rotated relative to each
+     * other, may hash differently.
+     *
+     * Every interior node stores the hash of the leaves below it.
+     * Operations that change the tree mark the nodes along the changed
+     * paths out of date and rehash just those before they return, so this
+     * costs O(1). operator== and diff use the same hashes to accept
+     * identical subtrees in O(1). Const functions only read the hashes, so
+     * they may be called from several threads at once, as long as no
+     * thread changes the Quadtree meanwhile.
+     *
+     * @return The hash, or 0 for an empty Quadtree
+     */
+    std::uint64_t contentHash() const;
+
+    /**
+     * Replaces the color of every pixel p of the image with map(p), by
+     * mapping the color of each leaf once and then recomputing the
+     * interior averages. This takes O(leaves) time, however many pixels
+     * the leaves cover.
+     *
+     * The leaf colors are gathered into one array, mapped in a single
+     * tight loop, and scattered back, so a cheap map such as a ColorLUT
+     * runs at the speed of its lookups. Nodes whose four children map to
+     * leaves of one color are merged, as by canonicalize. The mapped
+     * leaves become the source for the error statistics, and any stashed
+     * pruning is made permanent first.
+     *
+     * For example, to convert to grayscale:
+     *
+     *     tree.mapColors([](RGBAPixel const& p) {
+     *         uint8_t y = (299 * p.red + 587 * p.green + 114 * p.blue) / 1000;
+     *         return RGBAPixel(y, y, y, p.alpha);
+     *     });
+     *
+     * @param map A ColorLUT, a ColorCube, or any function or functor
+     *  taking an RGBAPixel const & and returning an RGBAPixel
+     */
+    template <class ColorMap>
+    void mapColors(ColorMap const& map);
+
 // PA 4 FUNCTIONS
 
     /**
@@ -218,8 +674,178 @@ class Quadtree
      */
     int idealPrune(int numLeaves) const;
 
+    /**
+     * Like prune(int), but measures the difference between two colors
+     * with the given distance policy instead of squared RGB distance.
+     * See colordistance.h for the policies that are available.
+     *
+     * @tparam Distance The color distance policy, e.g. RGBADistance
+     * @param tolerance The largest distance, as measured by Distance,
+     *  that a leaf may be from its ancestor's average
+     */
+    template <class Distance>
+    void prune(int tolerance);
+
+    /**
+     * Like pruneSize(int), but measures color differences with the given
+     * distance policy.
+     *
+     * @tparam Distance The color distance policy, e.g. RGBADistance
+     * @param tolerance The largest distance, as measured by Distance,
+     *  that a leaf may be from its ancestor's average
+     * @return How many leaves this Quadtree would have if it were pruned
+     *  with prune<Distance>(tolerance).
+     */
+    template <class Distance>
+    int pruneSize(int tolerance) const;
+
+    /**
+     * Like idealPrune(int), but measures color differences with the given
+     * distance policy. The search runs over [0, Distance::MAX_DISTANCE].
+     *
+     * @tparam Distance The color distance policy, e.g. RGBADistance
+     * @param numLeaves The number of leaves you want to remain in the tree
+     *  after prune<Distance> is called.
+     * @return The minimum tolerance needed to guarantee that there are no
+     *  more than numLeaves remaining in the tree.
+     */
+    template <class Distance>
+    int idealPrune(int numLeaves) const;
+
 // END PA 4 FUNCTIONS
 
+    /**
+     * Prunes the Quadtree as prune(int) does, but instead of deleting the
+     * collapsed subtrees, moves them into a side store (the "stash") from
+     * which unprune can reattach them. Moving a quality slider back and
+     * forth with reversiblePrune and unprune then costs time proportional
+     * to the number of nodes that change, not to the size of the image.
+     *
+     * The first call computes, for every interior node, the smallest
+     * tolerance that would prune it, which takes about as long as one call
+     * to pruneSize. The stash survives until an operation that changes the
+     * tree in any other way; such operations first make the stashed
+     * pruning permanent. Rotations only change the orientation, so they
+     * keep it. Copies of a Quadtree do not share its stash.
+     *
+     * @param tolerance The integer tolerance between two nodes that
+     *  determines whether the subtree can be pruned.
+     */
+    void reversiblePrune(int tolerance);
+
+    /**
+     * Like reversiblePrune(int), but measures color differences with the
+     * given distance policy. Switching to another policy makes the pruning
+     * stashed with the previous one permanent.
+     *
+     * @tparam Distance The color distance policy, e.g. RGBADistance
+     * @param tolerance The largest distance, as measured by Distance,
+     *  that a leaf may be from its ancestor's average
+     */
+    template <class Distance>
+    void reversiblePrune(int tolerance);
+
+    /**
+     * Moves the stashed pruning to the given tolerance: every stashed
+     * subtree whose root would not be pruned with tolerance is reattached,
+     * and if tolerance is higher than before, the tree is pruned further
+     * with the same distance policy. Afterwards the tree is as if
+     * reversiblePrune(tolerance) had been called, with that policy, on the
+     * tree as it was before the first reversiblePrune. Has no effect on
+     * subtrees that were not pruned by reversiblePrune, and does nothing
+     * unless reversiblePrune has been called since the stashed pruning
+     * was last made permanent.
+     *
+     * @param tolerance The tolerance to restore the tree to
+     */
+    void unprune(int tolerance);
+
+    /**
+     * Prunes the Quadtree until its image is as small as it can be while
+     * staying within a quality budget, instead of pruning to a tolerance.
+     *
+     * The error of the image is its mean squared error against the image
+     * the tree was built from, averaged over the red, green and blue
+     * samples of every pixel. It is computed from per-node sums and sums
+     * of squares that buildTree records, so no decompression is needed.
+     *
+     * Nodes whose four children are all leaves are collapsed one at a
+     * time, the one that adds the least error first. Every collapse saves
+     * exactly three leaves, so this is also the order of least error per
+     * leaf saved. Pruning stops before the collapse that would take the
+     * error above maxError.
+     *
+     * @param maxError The largest mean squared error to allow
+     */
+    void pruneToMSE(double maxError);
+
+    /**
+     * Like pruneToMSE, but the budget is given as a peak signal to noise
+     * ratio, \f$10 \log_{10}(255^2 / MSE)\f$, in decibels.
+     *
+     * @param minPSNR The smallest peak signal to noise ratio to allow
+     */
+    void pruneToPSNR(double minPSNR);
+
+    /**
+     * Prunes the Quadtree to a leaf count rather than to a tolerance.
+     *
+     * Pruning with idealPrune(numLeaves) can leave far fewer leaves than
+     * asked for, because many nodes become prunable at the same tolerance.
+     * This function instead collapses nodes whose four children are all
+     * leaves one at a time, in the order pruneToMSE uses, and stops as soon
+     * as no more than numLeaves leaves remain. Each collapse removes three
+     * leaves, so the tree ends up with numLeaves, numLeaves - 1 or
+     * numLeaves - 2 leaves (or a single leaf, if numLeaves is below 1).
+     * This takes O(n log n) time for a tree of n nodes.
+     *
+     * @param numLeaves The largest number of leaves to leave in the tree
+     */
+    void pruneToLeaves(int numLeaves);
+
+    /**
+     * Returns the mean squared error, over the red, green and blue samples
+     * of every pixel, of the image this Quadtree represents against the
+     * image it was built from. Returns 0 for an empty Quadtree.
+     *
+     * @return The mean squared error of this Quadtree's image
+     */
+    double meanSquaredError() const;
+
+    /**
+     * Statistics of the source pixels in a rectangle, as returned by
+     * queryRegionStats. Channels are indexed red, green, blue, alpha.
+     */
+    class RegionStats
+    {
+      public:
+        std::int64_t count; /**< number of pixels in the rectangle */
+        double mean[4];     /**< mean of each channel */
+        double variance[4]; /**< population variance of each channel */
+    };
+
+    /**
+     * Returns the mean and variance of each channel over the source pixels
+     * in the rectangle with top-left corner (x, y) and size w by h. The
+     * rectangle is clipped to the image first.
+     *
+     * The statistics are combined from the sums and sums of squares that
+     * every node keeps for its block, so a node lying entirely inside the
+     * rectangle is added in O(1) and the query only descends along the
+     * rectangle's boundary: it costs O(perimeter / leaf size + log n).
+     * A leaf that the rectangle only partly covers contributes its sums in
+     * proportion to the area covered, which is exact unless the leaf was
+     * pruned from source pixels that differ.
+     *
+     * @param x The x coordinate of the rectangle's top-left corner
+     * @param y The y coordinate of the rectangle's top-left corner
+     * @param w The width of the rectangle
+     * @param h The height of the rectangle
+     * @return The statistics of the rectangle; count is 0, and every mean
+     *  and variance 0, if it does not overlap a non-empty Quadtree
+     */
+    RegionStats queryRegionStats(int x, int y, int w, int h) const;
+
   private:
     /**
      * A simple class representing a single node of a Quadtree.
@@ -235,14 +861,91 @@ class Quadtree
         QuadtreeNode* seChild; /**< pointer to southeast child */
 
         RGBAPixel element; /**< the pixel stored as this node's "data" */
+        bool hasStats;     /**< whether this node is a StatsNode */
+        bool hashStale;    /**< whether the hash of this subtree is out of
+                                date; if it is, so is every ancestor's */
 
         QuadtreeNode();
         QuadtreeNode(RGBAPixel const& elem);
+
+        // return the child in the given quadrant: 0 nw, 1 ne, 2 sw, 3 se
+        QuadtreeNode* child(int quadrant) const;
+
+        // return the pointer to the child in the given quadrant, so that
+        // the child can be replaced
+        QuadtreeNode*& childSlot(int quadrant);
+
+        // return the sum of the given channel (0 red, 1 green, 2 blue,
+        // 3 alpha) over the source pixels of this node's block
+        std::int64_t sourceSum(int channel) const;
+
+        // return the sum of the squares of the same
+        std::int64_t sourceSumSq(int channel) const;
+    };
+
+    /**
+     * A node that stores the source statistics of its block. Interior
+     * nodes, and the leaves that pruning, composite and extractQuadrant
+     * create, are StatsNodes; the single pixel leaves built from the
+     * source are plain QuadtreeNodes, whose statistics are those of
+     * element alone.
+     */
+    class StatsNode : public QuadtreeNode
+    {
+      public:
+        std::int64_t sum[4];   /**< sums of red, green, blue and alpha over
+                                    the source pixels of this node's block */
+        std::int64_t sumSq[4]; /**< sums of the squares of the same */
+        std::uint64_t hash;    /**< while this node has children, the hash
+                                    of the leaves below it, see nodeHash */
+
+        StatsNode();
+        StatsNode(RGBAPixel const& elem);
+    };
+
+    /**
+     * An interior node and, while it is pruned by reversiblePrune, the
+     * children that were moved out of it.
+     */
+    class StashEntry
+    {
+      public:
+        int threshold;             /**< smallest tolerance that prunes node */
+        QuadtreeNode* node;        /**< the interior node */
+        int parent;                /**< index of the entry of node's parent,
+                                        or -1 for the root */
+        QuadtreeNode* children[4]; /**< node's nw, ne, sw and se children */
     };
 
     QuadtreeNode* root; /**< pointer to root of quadtree */
     int res; // resolution of the underlying bitmap
 
+    /**
+     * The eight ways the stored tree can be laid out in the image, as
+     * indices into ORIENTATIONS. Bit 2 of an index transposes the image,
+     * then bit 0 mirrors it left to right and bit 1 top to bottom.
+     */
+    enum Orientation
+    {
+        IDENTITY, MIRROR_X, MIRROR_Y, ROTATE_180,
+        TRANSPOSE, ROTATE_CCW, ROTATE_CW, ANTI_TRANSPOSE
+    };
+
+    // ORIENTATIONS[o][q] is the stored child shown in quadrant q (0 nw, 1 ne,
+    // 2 sw, 3 se) of a node's block in orientation o, at every level alike
+    static const int ORIENTATIONS[8][4];
+
+    // how the stored tree is laid out in the image; stash, prune and the
+    // source statistics all work on the stored tree and ignore it
+    int orientation;
+
+    // every interior node, in increasing order of threshold; the first
+    // stashed entries currently have their children moved out
+    std::vector<StashEntry> stash;
+    size_t stashed;
+    // the distance policy the stash was built with, or NULL if there is none
+    std::type_info const* stashPolicy;
+
     // helper function for deep delete
     // Used by destructor and copy/assignment
     // Deallocates Quadtree and its QuadtreeNode
@@ -251,6 +954,9 @@ class Quadtree
     // helper function for deleteQuadtree() and pruneChildren()
     void deleteQuadtree(QuadtreeNode*& node);
 
+    // delete node, but not its children, as the class it was allocated as
+    static void deleteNode(QuadtreeNode* node);
+
     // helper function for deep copy
     // Used by copy constructor and operator=
     void copyQuadtree(Quadtree const& other);
@@ -258,6 +964,11 @@ class Quadtree
     // helper function for copyQuadtree(Quadtree const& other)
     void copyQuadtree(QuadtreeNode*& myNode, QuadtreeNode* const& otherNode);
 
+    // helper function for move
+    // Used by move constructor and move assignment
+    // Takes over other's contents and leaves other empty
+    void moveQuadtree(Quadtree& other);
+
     /** private helper function for buildTree(PNG const& source, int resolution)
       * @param
       * source - reference to a const PNG object
@@ -276,8 +987,115 @@ class Quadtree
     // return the average of the given four byte number
     uint8_t getAvg(uint8_t n1, uint8_t n2, uint8_t n3, uint8_t n4);
 
-    // helper function for getPixel(int x, int y)
-    RGBAPixel getPixel(int x, int y, QuadtreeNode* node, int resolution) const;
+    // set the source statistics of node to those of area pixels of node's
+    // color; a node without stored statistics has them already
+    void setLeafStats(QuadtreeNode* node, std::int64_t area);
+
+    // set the source statistics of node to the sum of its children's
+    // Pre-condition: node must be a StatsNode with children
+    void getStatsOfChildren(QuadtreeNode* node);
+
+    // set the source statistics of child to those of the given quadrant
+    // (0 nw, 1 ne, 2 sw, 3 se) of leaf's block; the remainder of dividing
+    // by four goes to quadrant 3, so the four quarters add up to leaf's
+    void setQuarterStats(StatsNode* child, QuadtreeNode const* leaf, int quadrant);
+
+    // return the squared error, over red, green and blue, of the area source
+    // pixels of node's block against node's color
+    std::int64_t leafError(QuadtreeNode const* node, std::int64_t area) const;
+
+    // helper function of meanSquaredError()
+    std::int64_t totalError(QuadtreeNode const* node, std::int64_t area) const;
+
+    /** helper function of queryRegionStats()
+     * add the source sums and sums of squares of the part of node's block
+     * that lies in the rectangle [x0, x1) by [y0, y1)
+     * @param
+     * node - current node in Quadtree
+     * x, y - coordinates of top-left corner of the region represented by node
+     * resolution - the resolution of the region represented by node
+     * x0, y0, x1, y1 - the rectangle, which must overlap node's block
+     * sum, sumSq - the sums to add to, one per channel
+     */
+    void addRegionStats(QuadtreeNode const* node, int x, int y, int resolution,
+                        int x0, int y0, int x1, int y1,
+                        double* sum, double* sumSq) const;
+
+    // record every interior node, together with the smallest tolerance that
+    // would prune it, in the stash in increasing order of that tolerance
+    template <class Distance>
+    void buildStash();
+
+    // helper function of buildStash(); parent is the index of the entry of
+    // node's parent, or -1
+    template <class Distance>
+    void buildStash(QuadtreeNode* node, int parent, ColorConverter<Distance>& colors);
+
+    // move into the stash the subtrees of every node, not already stashed,
+    // that would be pruned with tolerance
+    void stashUpTo(int tolerance);
+
+    // mark the hashes of the node of stash entry index and of its
+    // ancestors out of date
+    void invalidateStashPath(int index);
+
+    // return the largest distance between avg and any leaf at or below node
+    template <class Distance>
+    int maxLeafDistance(typename Distance::Color const& avg, QuadtreeNode* node,
+                        ColorConverter<Distance>& colors) const;
+
+    // make the pruning done by reversiblePrune permanent: delete the stashed
+    // subtrees and empty the stash
+    void commitStash();
+
+    /**
+     * A node that pruneToMSE or pruneToLeaves may collapse, see
+     * collapseGreedily.
+     */
+    class CollapseCandidate
+    {
+      public:
+        QuadtreeNode* node;   /**< the interior node */
+        std::int64_t area;    /**< how many pixels node's block covers */
+        int parent;           /**< index of node's parent, or -1 for root */
+        int interiorChildren; /**< how many of node's children are not leaves */
+    };
+
+    /** collapse nodes whose children are all leaves, the one that adds the
+      * least squared error first, then merge the nodes left whose children
+      * are identical leaves
+      * @param
+      * errorBudget - largest total squared error the tree may reach
+      * numLeaves - stop once no more than this many leaves remain
+      */
+    void collapseGreedily(double errorBudget, int numLeaves);
+
+    // return how much collapsing candidate, whose children are all leaves,
+    // adds to the squared error of the tree
+    std::int64_t collapseCost(CollapseCandidate const& candidate) const;
+
+    // helper function of collapseGreedily(); appends node and its interior
+    // descendants to candidates, and returns the number of leaves below node
+    int collectCandidates(std::vector<CollapseCandidate>& candidates, QuadtreeNode* node,
+                          std::int64_t area, int parent, std::int64_t& error) const;
+
+    /** return the leaf whose block contains (x, y), descending iteratively and
+      * taking the child index at each level straight from the coordinate bits
+      * Pre-condition: root is not NULL and (x, y) is inside the image
+      * @param
+      * x, y - coordinates of the pixel
+      * left, top - set to the coordinates of the leaf block's top-left corner
+      * size - set to the width and height of the leaf's block
+      */
+    QuadtreeNode* findLeaf(int x, int y, int& left, int& top, int& size) const;
+
+    // return the Morton code of (x, y): the bits of y and x interleaved, with
+    // y's bit above x's, so that each pair of bits is the quadrant (0 nw, 1 ne,
+    // 2 sw, 3 se) to descend into at one level
+    static std::uint64_t mortonCode(int x, int y);
+
+    // the most levels a tree can have below its root; res is an int
+    static const int MAX_LEVELS = 31;
 
     // return true if given node has children (a node can have either zero or four children)
     bool hasChildren(QuadtreeNode* node) const ;
@@ -285,8 +1103,24 @@ class Quadtree
     // return true if the value of x or y is outside the bounds of underlying bitmap
     bool outOfBound(int x, int y) const;
 
-    // helper function for clockwiseRotate()
-    void clockwiseRotate(QuadtreeNode*& node);
+    // return node's child shown in the given quadrant (0 nw, 1 ne, 2 sw,
+    // 3 se) of node's block in the image
+    QuadtreeNode* childAt(QuadtreeNode const* node, int quadrant) const;
+
+    // convert coordinates in the image to coordinates in the stored tree
+    void toStored(int& x, int& y) const;
+
+    // change the orientation so that the image is transformed by rotation,
+    // an Orientation applied on top of the current one
+    void reorient(int rotation);
+
+    // helper function of materialize(); lays out node's descendants in the
+    // image's orientation
+    void materialize(QuadtreeNode* node);
+
+    // rearrange four children, given in stored order, into image order
+    void reorderChildren(QuadtreeNode*& nw, QuadtreeNode*& ne,
+                         QuadtreeNode*& sw, QuadtreeNode*& se) const;
 
     /** helper function of decompress()
      * transform a PNG img into the PNG image represented by this QuadTree
@@ -299,25 +1133,252 @@ class Quadtree
      */
     void transform (PNG& source, int resolution, int x, int y, QuadtreeNode* node) const ;
 
-    // helper function of prune(int tolerance)
-    // return true if all children (direct and indirect) of the given node are pruned
-    void prune(int tolerance, QuadtreeNode*& node);
+    /** helper function of decompress(PNG& target, int x, int y)
+     * fill the part of target that node's block covers
+     * @param
+     * target - the image to fill
+     * windowX, windowY - coordinates, in the tree, of target's upper-left corner
+     * resolution - the resolution of the region represented by node
+     * x - x-coordinate of top-left corner of the region represented by node
+     * y - y-coordinate of top-left corner of the region represented by node
+     * node - current node in Quadtree
+     */
+    void transformWindow(PNG& target, int windowX, int windowY, int resolution,
+                         int x, int y, QuadtreeNode* node) const;
+
+    /** helper function of decompressLevel(int k)
+     * fill the part of img covered by node's block, one pixel of img for
+     * every scale by scale block of the tree
+     * @param
+     * img - the downscaled image to fill
+     * scale - how many tree pixels wide one pixel of img is
+     * resolution - the resolution of the region represented by node
+     * x - x-coordinate of top-left corner of the region represented by node
+     * y - y-coordinate of top-left corner of the region represented by node
+     * node - current node in Quadtree
+     */
+    void transformLevel(PNG& img, int scale, int resolution, int x, int y, QuadtreeNode* node) const;
+
+    /**
+     * A block of the image that a decompress(int) thread fills on its own.
+     */
+    class DecompressTask
+    {
+      public:
+        QuadtreeNode* node; /**< node whose block this is */
+        int x;              /**< x-coordinate of the block's top-left corner */
+        int y;              /**< y-coordinate of the block's top-left corner */
+        int resolution;     /**< width and height of the block */
+    };
+
+    /** helper function of decompress(int numThreads)
+     * appends to tasks the nodes depth levels below node, or the leaves
+     * above that level
+     * @param
+     * tasks - the list of blocks to fill
+     * resolution - the resolution of the region represented by node
+     * x - x-coordinate of top-left corner of the region represented by node
+     * y - y-coordinate of top-left corner of the region represented by node
+     * node - current node in Quadtree
+     * depth - how many more levels to descend
+     */
+    void collectTasks(std::vector<DecompressTask>& tasks, int resolution, int x, int y,
+                      QuadtreeNode* node, int depth) const;
+
+    /** helper function of writeToFile() and decompressTo()
+     * fill the part of row y that lies in node's block, and return the first
+     * row after y that differs from row y within that block
+     * @param
+     * row - the row of pixels to fill, one pixel for every scale tree pixels
+     * y - the row being filled, in tree pixels, which must cross node's block
+     * resolution - the resolution of the region represented by node
+     * x - x-coordinate of top-left corner of the region represented by node
+     * top - y-coordinate of top-left corner of the region represented by node
+     * node - current node in Quadtree
+     * scale - how many tree pixels wide one pixel of row is; nodes this size
+     *    are not descended into
+     */
+    int fillRow(RGBAPixel* row, int y, int resolution, int x, int top,
+                QuadtreeNode* node, int scale) const;
+
+    /* return the bilinear blend of four pixels
+     * @param
+     * nw, ne, sw, se - the pixels at the corners of the cell
+     * fx - how far across the cell, from 0 (west) to 1 (east), to sample
+     * fy - how far down the cell, from 0 (north) to 1 (south), to sample
+     */
+    static RGBAPixel blend(RGBAPixel const& nw, RGBAPixel const& ne, RGBAPixel const& sw,
+                           RGBAPixel const& se, float fx, float fy);
+
+    /** fill a block of img with one color, row by row, writing straight into
+     * the pixel rows rather than going through PNG::operator()
+     * @param
+     * img - the image to fill, which must contain the whole block
+     * x - x-coordinate of top-left corner of the block
+     * y - y-coordinate of top-left corner of the block
+     * width, height - size of the block
+     * color - the color to fill the block with
+     */
+    void fillBlock(PNG& img, int x, int y, int width, int height, RGBAPixel const& color) const;
+
+    /**
+     * Smallest width and height of the tiles that boxBlur and gaussianBlur
+     * skip or filter as a whole; larger margins use larger tiles.
+     */
+    static const int BLUR_TILE = 64;
+
+    /** helper function of boxBlur() and gaussianBlur()
+     * return the image filtered with passes box filters in turn
+     * @param
+     * radii - the radius of each pass's box filter
+     * passes - how many box filters there are
+     */
+    PNG blur(int const* radii, int passes) const;
+
+    /** helper function of blur()
+     * fill one tile of result with the image filtered with passes box
+     * filters, decompressing only the tile and the margin around it
+     * @param
+     * result - the image to fill
+     * x, y - coordinates of the tile's top-left corner
+     * size - width and height of the tile
+     * radii - the radius of each pass's box filter
+     * passes - how many box filters there are
+     * margin - the sum of the radii
+     */
+    void blurTile(PNG& result, int x, int y, int size, int const* radii,
+                  int passes, int margin) const;
+
+    /** helper function of blurTile()
+     * fill dst, a window of the image filtered once with a box filter, from
+     * src, a window of the image before it; src must contain every pixel of
+     * the image within radius of dst
+     * @param
+     * src - the unfiltered window
+     * srcX, srcY - coordinates, in the image, of src's upper-left corner
+     * dst - the filtered window to fill
+     * dstX, dstY - coordinates, in the image, of dst's upper-left corner
+     * radius - how far the box extends on each side of a pixel
+     */
+    void boxPass(PNG const& src, int srcX, int srcY, PNG& dst, int dstX, int dstY, int radius) const;
 
-    // return true if all children (direct and indirect) of node are prunable
-    // Pre-condition: rootNode must have children
-    bool isChildrenPrunable(int tolerance, QuadtreeNode*& rootNode, QuadtreeNode*& node) const ;
+    // return the coordinate, on either axis, of the pixel in the image
+    // nearest to coordinate value
+    int clampToImage(int value) const;
 
-    // return true if the color difference between avgPixel and nodePixel is no more than tolerance
-    bool isPrunable(int tolerance, RGBAPixel avgPixel, RGBAPixel nodePixel) const ;
+    // helper function of prune<Distance>(int tolerance)
+    template <class Distance>
+    void prune(int tolerance, QuadtreeNode*& node, ColorConverter<Distance>& colors);
 
-    // return square of number n
-    int square (int n) const ;
+    // return true if no leaf at or below node is farther than tolerance from avg
+    template <class Distance>
+    bool isChildrenPrunable(int tolerance, typename Distance::Color const& avg, QuadtreeNode* node,
+                            ColorConverter<Distance>& colors) const ;
+
+    // return true if all four children of node are leaves
+    // Pre-condition: node must have children
+    bool hasLeafChildren(QuadtreeNode* node) const;
 
     // delete all descendants of the given node
     void pruneChildren(QuadtreeNode*& node);
 
-    // helper function of pruneSize(int tolerance)
-    int pruneSize(int tolerance, QuadtreeNode* node) const;
+    /** return the hash of the leaves at or below node, which only reads
+     * the tree: an interior node whose stored hash is out of date has it
+     * computed from below instead
+     * A leaf hashes its element (all four channels) and an interior node
+     * its children's hashes in stored order, so equal hashes mean equal
+     * subtrees, and equal images once the orientation is applied, but
+     * subtrees that were pruned differently can show the same image with
+     * different hashes.
+     */
+    static std::uint64_t nodeHash(QuadtreeNode const* node);
+
+    // return the hash of an interior node, combined from its children's
+    static std::uint64_t childrenHash(QuadtreeNode const* node);
+
+    // bring the stored hash of every out of date node up to date; every
+    // function that changes the tree calls it before returning, so that
+    // const functions find the hashes up to date and only read them
+    void refreshHashes();
+
+    // helper function of refreshHashes()
+    void refreshHashes(QuadtreeNode* node);
+
+    // scramble the bits of h (the splitmix64 finalizer)
+    static std::uint64_t mixHash(std::uint64_t h);
+
+    // mark node's hash out of date if any of its children's is
+    // Pre-condition: node must have children
+    void propagateHashStale(QuadtreeNode* node);
+
+    // helper function of canonicalize()
+    void canonicalize(QuadtreeNode* node);
+
+    // turn node into a leaf if its four children are leaves of the same
+    // color, which node's element and statistics already describe; return
+    // whether it did
+    bool mergeIdenticalChildren(QuadtreeNode* node);
+
+    // helper function of mapColors(); appends the leaves at or below node
+    // to leaves, in preorder
+    void collectLeaves(QuadtreeNode* node, std::vector<QuadtreeNode*>& leaves) const;
+
+    /** helper function of mapColors()
+     * after the leaves' colors have changed, reset their statistics,
+     * recompute the averages, statistics and hashes above them, and merge
+     * children that have become identical
+     * @param
+     * node - current node in Quadtree
+     * area - how many pixels node's block covers
+     */
+    void refreshAfterMap(QuadtreeNode* node, std::int64_t area);
+
+    /** helper function of composite()
+     * composite the overlay node over, of overTree, on top of node, whose
+     * blocks are the same part of the image
+     * @param
+     * node - current node in this Quadtree
+     * over - the node of overTree covering the same block
+     * overTree - the overlay Quadtree
+     * area - how many pixels the block covers
+     * mode - how to blend the colors
+     */
+    void composite(QuadtreeNode* node, QuadtreeNode const* over,
+                   Quadtree const& overTree, std::int64_t area, BlendMode mode);
+
+    // helper function of composite(); composite the single color color on
+    // top of every leaf at or below node, whose block covers area pixels
+    void compositeColor(QuadtreeNode* node, RGBAPixel const& color,
+                        std::int64_t area, BlendMode mode);
+
+    /** helper function of diff()
+     * compare the blocks of a, in this Quadtree, and b, in other, which
+     * cover the same part of the image, and append to blocks the largest
+     * blocks inside it that differ, unless all of it differs
+     * @param
+     * a - current node in this Quadtree
+     * b - the node of other covering the same block
+     * other - the Quadtree being compared with
+     * x, y - coordinates of top-left corner of the block
+     * resolution - the resolution of the block
+     * blocks - the list of differing blocks to append to
+     * @return whether every pixel of the block differs; the block is then
+     * left for the caller to append
+     */
+    bool diff(QuadtreeNode const* a, QuadtreeNode const* b, Quadtree const& other,
+              int x, int y, int resolution, std::vector<Block>& blocks) const;
+
+    // return the source-over composite of the overlay color over, blended
+    // with mode, on top of base
+    static RGBAPixel compositePixel(RGBAPixel const& base, RGBAPixel const& over,
+                                    BlendMode mode);
+
+    // helper function of pruneSize<Distance>(int tolerance)
+    template <class Distance>
+    int pruneSize(int tolerance, QuadtreeNode* node, ColorConverter<Distance>& colors) const;
+
+    // the smallest tolerance idealPrune considers
+    static const int MIN_TOLERANCE = 0;
 
     /** helper function of idealPrune()
       * binary search for the minimum tolerance given numLeaves
@@ -325,8 +1386,11 @@ class Quadtree
       * numLeaves - number of leaves we wish the quadtree to have after pruning
       * minTolerance - minimum tolerance of current level of search
       * maxTolerance - maximum tolerance of current level of search
+      * colors - the converter of the idealPrune call
       */
-    int searchTolerance(int numLeaves, int minTolerance, int maxTolerance) const ;
+    template <class Distance>
+    int searchTolerance(int numLeaves, int minTolerance, int maxTolerance,
+                        ColorConverter<Distance>& colors) const ;
 
 
 
@@ -335,4 +1399,383 @@ class Quadtree
 #include "quadtree_given.h"
 };
 
+class Quadtree::Cursor
+{
+  public:
+    /**
+     * Creates a cursor over the given Quadtree, with no leaf remembered.
+     * @param tree The Quadtree to look pixels up in
+     */
+    explicit Cursor(Quadtree const& tree);
+
+    /**
+     * Gets the same pixel as Quadtree::getPixel(x, y), answering from the
+     * remembered leaf when (x, y) lies in its block.
+     *
+     * @param x The x coordinate of the pixel to be retrieved
+     * @param y The y coordinate of the pixel to be retrieved
+     * @return The pixel at the given (x, y) location
+     */
+    RGBAPixel getPixel(int x, int y);
+
+  private:
+    Quadtree const* tree;           /**< the tree being looked up */
+    QuadtreeNode const* leaf;       /**< the last leaf found, or NULL */
+    int left;                       /**< x-coordinate of leaf's block in
+                                         the stored tree */
+    int top;                        /**< y-coordinate of leaf's block in
+                                         the stored tree */
+    int size;                       /**< width and height of leaf's block */
+};
+
+class Quadtree::Leaf
+{
+  public:
+    int x;           /**< x coordinate of the block's top-left corner */
+    int y;           /**< y coordinate of the block's top-left corner */
+    int size;        /**< width and height of the block */
+    RGBAPixel color; /**< color of every pixel in the block */
+};
+
+class Quadtree::LeafIterator
+{
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Leaf value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef Leaf const* pointer;
+    typedef Leaf const& reference;
+
+    /**
+     * Creates an iterator past the last leaf of any Quadtree.
+     */
+    LeafIterator();
+
+    /**
+     * @return The current leaf
+     */
+    Leaf const& operator*() const;
+
+    /**
+     * @return A pointer to the current leaf
+     */
+    Leaf const* operator->() const;
+
+    /**
+     * Advances to the next leaf, or past the last one.
+     * @return This iterator
+     */
+    LeafIterator& operator++();
+
+    /**
+     * Advances to the next leaf, or past the last one.
+     * @return A copy of this iterator from before it advanced
+     */
+    LeafIterator operator++(int);
+
+    /**
+     * @param other The iterator to compare with
+     * @return Whether both iterators are at the same leaf, or both past
+     *  the last one
+     */
+    bool operator==(LeafIterator const& other) const;
+
+    /**
+     * @param other The iterator to compare with
+     * @return Whether the iterators are at different leaves
+     */
+    bool operator!=(LeafIterator const& other) const;
+
+  private:
+    friend class Quadtree;
+
+    /**
+     * Creates an iterator at the first leaf of tree.
+     * @param tree The Quadtree whose leaves to walk
+     */
+    explicit LeafIterator(Quadtree const& tree);
+
+    // descend from path[depth] through northwest children to a leaf, and
+    // describe that leaf in leaf
+    void descend();
+
+    QuadtreeNode const* path[MAX_LEVELS + 1]; /**< nodes from the root to
+                                                   the current leaf */
+    int quadrant[MAX_LEVELS + 1]; /**< quadrant of path[d] in path[d - 1],
+                                       in the image */
+    int const* order;             /**< the tree's row of ORIENTATIONS */
+    int depth;                    /**< depth of the current leaf, or -1 past
+                                       the last leaf */
+    int resolution;               /**< resolution of the tree */
+    Leaf leaf;                    /**< the current leaf */
+};
+
+class Quadtree::LeafRange
+{
+  public:
+    /**
+     * @return An iterator at the first leaf
+     */
+    LeafIterator begin() const;
+
+    /**
+     * @return An iterator past the last leaf
+     */
+    LeafIterator end() const;
+
+  private:
+    friend class Quadtree;
+
+    /**
+     * @param tree The Quadtree whose leaves this range holds
+     */
+    explicit LeafRange(Quadtree const& tree);
+
+    Quadtree const* tree; /**< the tree whose leaves this range holds */
+};
+
+template <class Visitor>
+void Quadtree::forEachLeaf(Visitor visit) const
+{
+    for (LeafIterator it(*this), end; it != end; ++it)
+        visit(*it);
+}
+
+template <class ColorMap>
+void Quadtree::mapColors(ColorMap const& map)
+{
+    if (root == NULL)
+        return;
+    commitStash();
+    std::vector<QuadtreeNode*> leaves;
+    collectLeaves(root, leaves);
+
+    std::vector<RGBAPixel> colors(leaves.size());
+    for (size_t i = 0; i < leaves.size(); i++)
+        colors[i] = leaves[i]->element;
+    for (size_t i = 0; i < colors.size(); i++)
+        colors[i] = map(colors[i]);
+    for (size_t i = 0; i < leaves.size(); i++)
+        leaves[i]->element = colors[i];
+
+    refreshAfterMap(root, (std::int64_t) res * res);
+    refreshHashes();
+}
+
+// The prune family is defined here, rather than in quadtree.cpp, so that it
+// can be instantiated with distance policies other than those in
+// colordistance.h.
+
+// prune (public interface)
+//   - parameters: int tolerance - see prune(int tolerance); the "distance"
+//                    is measured by the Distance policy
+//   - prunes the quadtree as prune(int tolerance) does
+template <class Distance>
+void Quadtree::prune(int tolerance)
+{
+    commitStash();
+    if (root != NULL){
+        ColorConverter<Distance> colors;
+        prune<Distance>(tolerance, root, colors);
+        refreshHashes();
+    }
+}
+
+// helper function of prune<Distance>(int tolerance)
+template <class Distance>
+void Quadtree::prune(int tolerance, QuadtreeNode*& node, ColorConverter<Distance>& colors){
+    if (!hasChildren(node)){
+        return;
+    } else {
+        if (isChildrenPrunable<Distance>(tolerance, colors.convert(node->element), node, colors)){
+            pruneChildren(node);
+        } else {
+            prune<Distance>(tolerance, node->nwChild, colors);
+            prune<Distance>(tolerance, node->neChild, colors);
+            prune<Distance>(tolerance, node->swChild, colors);
+            prune<Distance>(tolerance, node->seChild, colors);
+            propagateHashStale(node);
+        }
+    }
+}
+
+/** return true if no leaf at or below node is farther than tolerance from avg
+  * @param
+  * tolerance - see prune(int tolerance)
+  * avg - color of the root of the subtree to be pruned, converted by Distance
+  * node - current node to be checked whether it is prunable
+  * colors - the converter of the calling prune family function
+  */
+template <class Distance>
+bool Quadtree::isChildrenPrunable(int tolerance, typename Distance::Color const& avg, QuadtreeNode* node,
+                                  ColorConverter<Distance>& colors) const {
+    if (!hasChildren(node)){
+        // node is a leaf
+        return Distance::distance(avg, colors.convert(node->element)) <= tolerance;
+    } else if (hasLeafChildren(node)){
+        // the bottom level of the subtree: measure the four leaves as one batch
+        typename Distance::Color leaves[4] = {
+            colors.convert(node->nwChild->element),
+            colors.convert(node->neChild->element),
+            colors.convert(node->swChild->element),
+            colors.convert(node->seChild->element)
+        };
+        return Distance::maxDistance(avg, leaves, 4) <= tolerance;
+    } else {
+        return isChildrenPrunable<Distance>(tolerance, avg, node->nwChild, colors) &&
+               isChildrenPrunable<Distance>(tolerance, avg, node->neChild, colors) &&
+               isChildrenPrunable<Distance>(tolerance, avg, node->swChild, colors) &&
+               isChildrenPrunable<Distance>(tolerance, avg, node->seChild, colors);
+    }
+}
+
+// pruneSize (public interface)
+//   - parameters: int tolerance - see prune<Distance>(int tolerance)
+//   - returns the number of leaves which this quadtree would contain if it
+//        was pruned using prune<Distance>(tolerance)
+template <class Distance>
+int Quadtree::pruneSize(int tolerance) const
+{
+    if (root == NULL) return 0;
+    ColorConverter<Distance> colors;
+    return pruneSize<Distance>(tolerance, root, colors);
+}
+
+// helper function of pruneSize<Distance>(int tolerance)
+template <class Distance>
+int Quadtree::pruneSize(int tolerance, QuadtreeNode* node, ColorConverter<Distance>& colors) const{
+    if (!hasChildren(node)){
+        return 1;
+    } else {
+        if (isChildrenPrunable<Distance>(tolerance, colors.convert(node->element), node, colors)){
+            return 1;
+        } else {
+            return pruneSize<Distance>(tolerance, node->nwChild, colors) +
+                   pruneSize<Distance>(tolerance, node->neChild, colors) +
+                   pruneSize<Distance>(tolerance, node->swChild, colors) +
+                   pruneSize<Distance>(tolerance, node->seChild, colors);
+        }
+    }
+}
+
+// idealPrune (public interface)
+//   - parameters: int numLeaves - see idealPrune(int numLeaves)
+//   - returns the minimum tolerance such that prune<Distance> with that
+//        tolerance would yield a tree with at most numLeaves leaves
+template <class Distance>
+int Quadtree::idealPrune(int numLeaves) const
+{
+    if (root == NULL) return 0;
+    ColorConverter<Distance> colors;
+    return searchTolerance<Distance>(numLeaves, MIN_TOLERANCE, Distance::MAX_DISTANCE, colors);
+}
+
+
+/** helper function of idealPrune()
+  * binary search for the minimum tolerance given numLeaves
+  * @param
+  * numLeaves - number of leaves we wish the quadtree to have after pruning
+  * minTolerance - minimum tolerance of current level of search
+  * maxTolerance - maximum tolerance of current level of search
+  * colors - the converter of the idealPrune call
+  */
+template <class Distance>
+int Quadtree::searchTolerance(int numLeaves, int minTolerance, int maxTolerance,
+                              ColorConverter<Distance>& colors) const {
+    int tryTolerance = (minTolerance + maxTolerance) / 2;
+    int numLeavesAfterTry = pruneSize<Distance>(tryTolerance, root, colors);
+    if (numLeavesAfterTry <= numLeaves){
+        if (pruneSize<Distance>(tryTolerance - 1, root, colors) > numLeaves) {
+            return tryTolerance;
+        } else {         // tryTolerance is too large
+            return searchTolerance<Distance>(numLeaves, minTolerance, tryTolerance, colors);
+        }
+    } else {            // tryTolerance is too small
+        return searchTolerance<Distance>(numLeaves, tryTolerance, maxTolerance, colors);
+    }
+}
+
+// reversiblePrune (public interface)
+//   - parameters: int tolerance - see prune<Distance>(int tolerance)
+//   - prunes as prune<Distance>(int tolerance) does, but moves the collapsed
+//        subtrees into the stash so that unprune can reattach them
+template <class Distance>
+void Quadtree::reversiblePrune(int tolerance)
+{
+    if (root == NULL) return;
+    if (stashPolicy == NULL || *stashPolicy != typeid(Distance)){
+        commitStash();
+        buildStash<Distance>();
+    }
+    stashUpTo(tolerance);
+    refreshHashes();
+}
+
+// record every interior node, together with the smallest tolerance that
+// would prune it, in the stash in increasing order of that tolerance
+template <class Distance>
+void Quadtree::buildStash(){
+    ColorConverter<Distance> colors;
+    buildStash<Distance>(root, -1, colors);
+
+    // sort by threshold, and point each parent index at the parent's new
+    // position
+    std::vector<int> order(stash.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = (int) i;
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+        return stash[a].threshold < stash[b].threshold;
+    });
+    std::vector<int> position(stash.size());
+    for (size_t i = 0; i < order.size(); i++) position[order[i]] = (int) i;
+    std::vector<StashEntry> sorted;
+    sorted.reserve(stash.size());
+    for (size_t i = 0; i < order.size(); i++){
+        StashEntry entry = stash[order[i]];
+        if (entry.parent >= 0) entry.parent = position[entry.parent];
+        sorted.push_back(entry);
+    }
+    stash.swap(sorted);
+    stashed = 0;
+    stashPolicy = &typeid(Distance);
+}
+
+// helper function of buildStash(); parent is the index of the entry of
+// node's parent, or -1
+template <class Distance>
+void Quadtree::buildStash(QuadtreeNode* node, int parent, ColorConverter<Distance>& colors){
+    if (!hasChildren(node)) return;
+    StashEntry entry;
+    entry.threshold = maxLeafDistance<Distance>(colors.convert(node->element), node, colors);
+    entry.node = node;
+    entry.parent = parent;
+    int index = (int) stash.size();
+    stash.push_back(entry);
+    buildStash<Distance>(node->nwChild, index, colors);
+    buildStash<Distance>(node->neChild, index, colors);
+    buildStash<Distance>(node->swChild, index, colors);
+    buildStash<Distance>(node->seChild, index, colors);
+}
+
+// return the largest distance between avg and any leaf at or below node
+template <class Distance>
+int Quadtree::maxLeafDistance(typename Distance::Color const& avg, QuadtreeNode* node,
+                              ColorConverter<Distance>& colors) const {
+    if (!hasChildren(node)){
+        return Distance::distance(avg, colors.convert(node->element));
+    } else if (hasLeafChildren(node)){
+        typename Distance::Color leaves[4] = {
+            colors.convert(node->nwChild->element),
+            colors.convert(node->neChild->element),
+            colors.convert(node->swChild->element),
+            colors.convert(node->seChild->element)
+        };
+        return Distance::maxDistance(avg, leaves, 4);
+    } else {
+        return std::max(std::max(maxLeafDistance<Distance>(avg, node->nwChild, colors),
+                                 maxLeafDistance<Distance>(avg, node->neChild, colors)),
+                        std::max(maxLeafDistance<Distance>(avg, node->swChild, colors),
+                                 maxLeafDistance<Distance>(avg, node->seChild, colors)));
+    }
+}
+
 #endif
@@ -53,11 +53,11 @@ void Quadtree::printTree(ostream& out, QuadtreeNode const* current,
         exit(1);
     }
 
-    // Standard preorder traversal
-    printTree(out, current->neChild, level + 1);
-    printTree(out, current->seChild, level + 1);
-    printTree(out, current->swChild, level + 1);
-    printTree(out, current->nwChild, level + 1);
+    // Standard preorder traversal, in the orientation the image is viewed in
+    printTree(out, childAt(current, 1), level + 1);
+    printTree(out, childAt(current, 3), level + 1);
+    printTree(out, childAt(current, 2), level + 1);
+    printTree(out, childAt(current, 0), level + 1);
 }
 
 // operator==
@@ -71,7 +71,15 @@ void Quadtree::printTree(ostream& out, QuadtreeNode const* current,
 // Note: this method relies on the private helper method compareTrees()
 bool Quadtree::operator==(Quadtree const& other) const
 {
-    return compareTrees(root, other.root);
+    if (orientation == other.orientation)
+        return compareTrees(root, other.root, ORIENTATIONS[IDENTITY]);
+
+    // pair each stored child of ours with the stored child of other's that
+    // is shown in the same quadrant of the image
+    int order[4];
+    for (int q = 0; q < 4; q++)
+        order[ORIENTATIONS[orientation][q]] = ORIENTATIONS[other.orientation][q];
+    return compareTrees(root, other.root, order);
 }
 
 // compareTrees
@@ -81,6 +89,9 @@ bool Quadtree::operator==(Quadtree const& other) const
 //                 QuadtreeNode const * secondPtr - pointer to the root
 //                    of a subtree of the "second" Quadtree under
 //                    consideration
+//                 int const * order - for each quadrant of a node of the
+//                    first Quadtree, the quadrant of the second Quadtree's
+//                    node that is shown in the same place
 //   - return value: a boolean which is true if the subQuadtrees are deemed
 //        "equal", and false otherwise
 //   - compares the subQuadtree rooted at firstPtr with the subQuadtree
@@ -88,7 +99,8 @@ bool Quadtree::operator==(Quadtree const& other) const
 //   - this function only compares the leaves of the trees, as we did not
 //     impose any requirements on what you should do with interior nodes
 bool Quadtree::compareTrees(QuadtreeNode const* firstPtr,
-                            QuadtreeNode const* secondPtr) const
+                            QuadtreeNode const* secondPtr,
+                            int const* order) const
 {
     if (firstPtr == NULL && secondPtr == NULL)
         return true;
@@ -96,6 +108,12 @@ bool Quadtree::compareTrees(QuadtreeNode const* firstPtr,
     if (firstPtr == NULL || secondPtr == NULL)
         return false;
 
+    // identical subtrees laid out alike are equal; anything else may still
+    // show the same colors, so it is walked
+    if (order == ORIENTATIONS[IDENTITY]
+        && nodeHash(firstPtr) == nodeHash(secondPtr))
+        return true;
+
     // if they're both leaves, see if their elements are equal
     // note: child pointers should _all_ either be NULL or non-NULL,
     // so it suffices to check only one of each
@@ -109,8 +127,8 @@ bool Quadtree::compareTrees(QuadtreeNode const* firstPtr,
     }
 
     // they aren't both leaves, so recurse
-    return (compareTrees(firstPtr->neChild, secondPtr->neChild)
-            && compareTrees(firstPtr->nwChild, secondPtr->nwChild)
-            && compareTrees(firstPtr->seChild, secondPtr->seChild)
-            && compareTrees(firstPtr->swChild, secondPtr->swChild));
+    return (compareTrees(firstPtr->neChild, secondPtr->child(order[1]), order)
+            && compareTrees(firstPtr->nwChild, secondPtr->child(order[0]), order)
+            && compareTrees(firstPtr->seChild, secondPtr->child(order[3]), order)
+            && compareTrees(firstPtr->swChild, secondPtr->child(order[2]), order));
 }
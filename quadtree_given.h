@@ -39,8 +39,12 @@ void printTree(std::ostream& out, QuadtreeNode const* current, int level) const;
  *  Quadtree under consideration
  * @param secondPtr Pointer to the root of a subtree of the "second"
  *  Quadtree under consideration
+ * @param order For each quadrant of a node of the first Quadtree, the
+ *  quadrant of the second Quadtree's node that is shown in the same place;
+ *  ORIENTATIONS[IDENTITY] itself if the trees are laid out alike, which
+ *  lets equal subtree hashes stand in for a walk
  * @return True if the subQuadtrees are deemed "equal", and false
  *  otherwise
  */
 bool compareTrees(QuadtreeNode const* firstPtr,
-                  QuadtreeNode const* secondPtr) const;
+                  QuadtreeNode const* secondPtr, int const* order) const;